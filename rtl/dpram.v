@@ -40,7 +40,7 @@ module dpram #(
 );
 
 	localparam ramLength = (2**address_width);
-	reg [data_width-1:0] mem [ramLength-1:0];
+	reg [data_width-1:0] mem [ramLength-1:0]/*verilator public_flat*/;
 
 	always @(posedge clock) begin
 		if(enable_a)
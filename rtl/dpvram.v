@@ -48,8 +48,16 @@ module dpvram #(
 		end
 	end
 
+`ifndef SIM_SINGLE_EDGE
 	always @(negedge clock_b) begin
 		q_b <= mem[address_b];
 	end
+`else
+	// Single edge simulation: address_b and mem only change on the rising edge, so reading
+	// through gives the value the falling edge would have registered
+	always @(*) begin
+		q_b = mem[address_b];
+	end
+`endif
 
 endmodule
\ No newline at end of file
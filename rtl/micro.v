@@ -35,12 +35,12 @@ module micro
 	output wire			s_phi_0/*verilator public_flat*/,
 	output wire			s_phi_2,
 	output reg			s_irq_n,
-	output wire			s_READWRITE,
+	output wire			s_READWRITE/*verilator public_flat*/,
 	output wire			s_WRITE_n,
 	output wire			s_br_w_n,
 	output wire			s_16FLIP,
 	output wire	[15:0]	s_addr/*verilator public_flat*/,
-	output wire	[7:0]	s_db_out,
+	output wire	[7:0]	s_db_out/*verilator public_flat*/,
 	output wire			sync/*verilator public_flat*/
 );
 
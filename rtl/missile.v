@@ -364,12 +364,25 @@ begin
 end
 
 // Latch PHI EXTEND into MUSHROOM on next falling edge of PHI X
+`ifndef SIM_SINGLE_EDGE
 always @(negedge clk_10M)
 begin
 	reg s_phi_x_last;
 	s_phi_x_last <= s_phi_x;
 	if(!s_phi_x && s_phi_x_last) s_MUSHROOM <= s_phi_extend;
 end
+`else
+// Single edge simulation: the inputs only change on the rising edge, so the value the
+// falling edge would latch is worked out combinationally and held on the next rising edge
+reg s_phi_x_last = 1'b0;
+reg s_MUSHROOM_held = 1'b0;
+always @(posedge clk_10M)
+begin
+	s_phi_x_last <= s_phi_x;
+	s_MUSHROOM_held <= s_MUSHROOM;
+end
+always @(*) s_MUSHROOM = (!s_phi_x && s_phi_x_last) ? s_phi_extend : s_MUSHROOM_held;
+`endif
 
 ////////////////////////////////
 // DRAM PICTURE OUTPUT ENABLE //
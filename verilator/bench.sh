@@ -0,0 +1,97 @@
+#!/bin/sh
+# Runs the headless sim over fixed scenarios and prints the results as JSON
+#
+# usage: sh bench.sh [-n repeats] [-b binary] [scenario ...]
+#   scenarios: boot attract gameplay selftest (default: all of them)
+#   BENCH_ARGS passes extra options to the sim, e.g. BENCH_ARGS="--roms /path/to/roms/"
+#
+# Every run is a separate process so peak RSS is per run and no state carries over.
+# Per scenario the report has each run plus the mean, standard deviation, min and
+# max of the rates, with the model options from obj_dir/options.txt to label the build.
+
+REPEATS=3
+BINARY=./sim_headless
+while [ $# -gt 0 ]; do
+	case "$1" in
+	-n) REPEATS=$2; shift 2;;
+	-b) BINARY=$2; shift 2;;
+	*) break;;
+	esac
+done
+SCENARIOS=${*:-boot attract gameplay selftest}
+
+if [ ! -x "$BINARY" ]; then
+	echo "$BINARY not found, build it with make headless" >&2
+	exit 2
+fi
+
+OPTIONS=$(cat obj_dir/options.txt 2>/dev/null | sed 's/^ *//; s/"/\\"/g')
+VERSION=$(verilator --version 2>/dev/null | sed 's/"/\\"/g')
+
+printf '{\n  "build": { "binary": "%s", "verilator": "%s", "model_options": "%s" },\n' "$BINARY" "$VERSION" "$OPTIONS"
+printf '  "repeats": %d,\n  "scenarios": {' "$REPEATS"
+
+STATUS=0
+SEPARATOR=""
+for SCENARIO in $SCENARIOS; do
+	RUNS=""
+	i=0
+	while [ $i -lt "$REPEATS" ]; do
+		echo "$SCENARIO run $((i + 1))/$REPEATS" >&2
+		OUTPUT=$($BINARY --scenario "$SCENARIO" --json $BENCH_ARGS)
+		CODE=$?
+		RUN=$(printf '%s\n' "$OUTPUT" | grep '^{')
+		RESULT=$(printf '%s' "$RUN" | sed -n 's/.*"result": *\([0-9-]*\).*/\1/p')
+		# Only runs that reached their limit are timed, a run that stopped early would skew the rates
+		if [ -z "$RUN" ] || [ "$CODE" -ne 0 ] || [ "$RESULT" != "0" ]; then
+			echo "$SCENARIO failed (exit $CODE, result ${RESULT:-none})" >&2
+			STATUS=1
+			break
+		fi
+		RUNS="$RUNS$RUN
+"
+		i=$((i + 1))
+	done
+	printf '%s\n    "%s": ' "$SEPARATOR" "$SCENARIO"
+	SEPARATOR=","
+	# Each run is a flat JSON object on one line
+	printf '%s' "$RUNS" | awk '
+		function stat(name,    i, sum, mean, sq, lo, hi) {
+			sum = 0; lo = value[1, name]; hi = lo
+			for (i = 1; i <= n; i++) {
+				sum += value[i, name]
+				if (value[i, name] < lo) lo = value[i, name]
+				if (value[i, name] > hi) hi = value[i, name]
+			}
+			mean = sum / n
+			sq = 0
+			for (i = 1; i <= n; i++) sq += (value[i, name] - mean) ^ 2
+			return sprintf("\"%s\": { \"mean\": %.6g, \"stddev\": %.6g, \"min\": %.6g, \"max\": %.6g }",
+				name, mean, n > 1 ? sqrt(sq / (n - 1)) : 0, lo, hi)
+		}
+		NF {
+			n++
+			run[n] = $0
+			line = $0
+			gsub(/[{}"]/, "", line)
+			count = split(line, fields, ",")
+			for (f = 1; f <= count; f++) {
+				split(fields[f], pair, ":")
+				gsub(/ /, "", pair[1]); gsub(/ /, "", pair[2])
+				value[n, pair[1]] = pair[2] ~ /^[-0-9.e+]+$/ ? pair[2] + 0 : pair[2]
+			}
+		}
+		END {
+			if (n == 0) { printf "null"; exit }
+			printf "{\n      \"frames\": %s, \"cycles\": %s, \"threads\": %s, \"edges\": %s,\n", value[1, "frames"], value[1, "cycles"], value[1, "threads"], value[1, "edges"]
+			printf "      %s,\n", stat("cycles_per_s")
+			printf "      %s,\n", stat("frames_per_s")
+			printf "      %s,\n", stat("wall_s")
+			printf "      %s,\n", stat("peak_rss_kb")
+			printf "      \"runs\": [\n"
+			for (i = 1; i <= n; i++) printf "        %s%s\n", run[i], i < n ? "," : ""
+			printf "      ]\n    }"
+		}'
+done
+printf '\n  }\n}\n'
+exit $STATUS
@@ -0,0 +1,73 @@
+// Prints a binary log written with --log-binary in the same form as --log text logs
+//
+// usage: logdump [--severity info|warning|error] [--source sim|bus|rtl] [--from TIME] [--to TIME] FILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "sim_log.h"
+
+static int lookup(const char* name, const char** names, int count) {
+	for (int i = 0; i < count; i++) {
+		if (strcmp(name, names[i]) == 0) { return i; }
+	}
+	return -1;
+}
+
+int main(int argc, char** argv) {
+	int minSeverity = log_info;
+	int onlySource = -1;
+	unsigned long long from = 0;
+	unsigned long long to = ~0ULL;
+	const char* file = NULL;
+	bool valid = true;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--severity" && hasValue) { minSeverity = lookup(argv[++i], SimLog_SeverityNames, 3); valid = valid && minSeverity >= 0; }
+		else if (arg == "--source" && hasValue) { onlySource = lookup(argv[++i], SimLog_SourceNames, 3); valid = valid && onlySource >= 0; }
+		else if (arg == "--from" && hasValue) { from = strtoull(argv[++i], NULL, 10); }
+		else if (arg == "--to" && hasValue) { to = strtoull(argv[++i], NULL, 10); }
+		else if (arg[0] != '-' && !file) { file = argv[i]; }
+		else { valid = false; }
+	}
+	if (!file || !valid) {
+		printf("usage: %s [--severity info|warning|error] [--source sim|bus|rtl] [--from TIME] [--to TIME] FILE\n", argv[0]);
+		return 2;
+	}
+
+	FILE* log = fopen(file, "rb");
+	if (!log) {
+		printf("Cannot read log file: %s\n", file);
+		return 2;
+	}
+	char magic[sizeof(SimLog_Magic)];
+	if (fread(magic, 1, sizeof(magic), log) != sizeof(magic) || memcmp(magic, SimLog_Magic, sizeof(magic)) != 0) {
+		printf("Not a binary log file: %s\n", file);
+		fclose(log);
+		return 2;
+	}
+
+	unsigned char header[SimLog_HeaderSize];
+	char text[0x10000];
+	long records = 0;
+	int result = 0;
+	while (fread(header, 1, SimLog_HeaderSize, log) == SimLog_HeaderSize) {
+		unsigned long long time = 0;
+		for (int i = 7; i >= 0; i--) { time = time << 8 | header[i]; }
+		int severity = header[8];
+		int source = header[9];
+		int length = header[10] | header[11] << 8;
+		if (fread(text, 1, length, log) != (size_t)length || severity > log_error || source > log_rtl) {
+			fprintf(stderr, "Log is damaged after %ld records\n", records);
+			result = 1;
+			break;
+		}
+		records++;
+		if (severity < minSeverity || (onlySource >= 0 && source != onlySource) || time < from || time > to) { continue; }
+		printf("%llu %s %s: %.*s\n", time, SimLog_SeverityNames[severity], SimLog_SourceNames[source], length, text);
+	}
+	fclose(log);
+	return result;
+}
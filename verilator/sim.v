@@ -40,6 +40,8 @@ module emu(
 	output			VGA_HB,
 	output			VGA_VB,
 
+	output [5:0]	AUDIO/*verilator public_flat*/,
+
 	input			ioctl_download,
 	input			ioctl_upload,
 	output			ioctl_upload_req,
@@ -71,7 +73,7 @@ wire slam		= inputs[10];
 reg ce_5M = 1'b0;
 always @(posedge clk_10) ce_5M <= ~ce_5M;
 
-reg			rom_downloaded = 0;
+reg			rom_downloaded/*verilator public_flat*/ = 0;
 wire		rom_download = ioctl_download && ioctl_index == 8'b0;
 wire		reset/*verilator public_flat*/;
 assign		reset = (RESET | rom_download | !rom_downloaded); 
@@ -122,7 +124,7 @@ missile missile(
 	.clk_10M(clk_10),
 	.ce_5M(ce_5M),
 	.reset(reset),
-	.audio_o(),
+	.audio_o(AUDIO),
 
 	.htb_dir1(htb_dir1),
 	.htb_clk1(htb_clk1),
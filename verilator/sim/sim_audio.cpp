@@ -0,0 +1,272 @@
+#include "sim_audio.h"
+#include <string.h>
+
+#include "inc/miniz.h"
+
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+#include <SDL.h>
+#endif
+
+// Sample ring
+// -----------
+
+SimAudioRing::SimAudioRing() {
+	mask = 0;
+	head = 0;
+	tail = 0;
+}
+
+void SimAudioRing::Resize(uint32_t capacity) {
+	uint32_t size = 1;
+	while (size < capacity) { size <<= 1; }
+	buffer.assign(size, 0);
+	mask = size - 1;
+	Clear();
+}
+
+void SimAudioRing::Clear() {
+	head = 0;
+	tail = 0;
+}
+
+// Decimation and capture
+// ----------------------
+
+SimAudio::SimAudio() {
+	enabled = false;
+	clockRate = 10000000;
+	sampleRate = 48000;
+	inputBits = 6;
+	blockSize = 4096;
+	queueLimit = 16;
+	samplesWritten = 0;
+	checksum = MZ_CRC32_INIT;
+	writeErrors = 0;
+	latency = 4096;
+	underruns = 0;
+	overruns = 0;
+	playbackRate = 1.0f;
+	sum = 0;
+	count = 0;
+	phase = 0;
+	writing = false;
+	stopping = false;
+	wav = NULL;
+	live = false;
+	overrunning = false;
+	device = 0;
+	deviceStep = 1.0;
+	step = 1.0;
+	position = 0.0;
+	buffering = true;
+	lastSample = 0;
+}
+
+SimAudio::~SimAudio() {
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+	CloseDevice();
+#endif
+	Stop();
+}
+
+// Starts decimating, and writing the WAV file if one is set
+bool SimAudio::Start() {
+	Stop();
+	sum = 0;
+	count = 0;
+	phase = 0;
+	if (!wavFile.empty()) {
+		wav = fopen(wavFile.c_str(), "wb");
+		if (!wav) {
+			fprintf(stderr, "Cannot write WAV file: %s\n", wavFile.c_str());
+			return false;
+		}
+		samplesWritten = 0;
+		checksum = MZ_CRC32_INIT;
+		writeErrors = 0;
+		WriteHeader(0);
+		block.clear();
+		block.reserve(blockSize);
+		stopping = false;
+		worker = std::thread(&SimAudio::Run, this);
+		writing = true;
+	}
+	enabled = true;
+	return true;
+}
+
+// Writes out the part block, waits for the worker and completes the WAV header
+void SimAudio::Stop() {
+	enabled = false;
+	if (!writing) { return; }
+	writing = false;
+	Flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queueChanged.notify_all();
+	worker.join();
+	WriteHeader((uint32_t)(samplesWritten * sizeof(int16_t)));
+	fclose(wav);
+	wav = NULL;
+}
+
+// Average of the input since the last sample, scaled to the full signed 16-bit range
+void SimAudio::Emit() {
+	phase -= clockRate;
+	int sample = (int)(((uint64_t)sum << (16 - inputBits)) / count) - 32768;
+	sum = 0;
+	count = 0;
+	if (live.load(std::memory_order_relaxed)) {
+		if (ring.Push((int16_t)sample)) { overrunning = false; }
+		else if (!overrunning) { overrunning = true; overruns++; }
+	}
+	if (writing) {
+		block.push_back((int16_t)sample);
+		if ((int)block.size() >= blockSize) { Flush(); }
+	}
+}
+
+void SimAudio::Flush() {
+	if (block.empty()) { return; }
+	std::unique_lock<std::mutex> lock(mutex);
+	queueChanged.wait(lock, [this] { return (int)queue.size() < queueLimit; });
+	queue.push_back(std::move(block));
+	if (!spare.empty()) {
+		block = std::move(spare.back());
+		spare.pop_back();
+	}
+	lock.unlock();
+	queueChanged.notify_all();
+	block.clear();
+	block.reserve(blockSize);
+}
+
+void SimAudio::Run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		queueChanged.wait(lock, [this] { return !queue.empty() || stopping; });
+		if (queue.empty()) { break; }
+		std::vector<int16_t> samples = std::move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+		queueChanged.notify_all();
+
+		Write(samples);
+
+		lock.lock();
+		spare.push_back(std::move(samples));
+	}
+}
+
+void SimAudio::Write(const std::vector<int16_t>& samples) {
+	size_t bytes = samples.size() * sizeof(int16_t);
+	checksum = (uint32_t)mz_crc32(checksum, (const unsigned char*)samples.data(), bytes);
+	if (fwrite(samples.data(), 1, bytes, wav) != bytes) { writeErrors++; }
+	samplesWritten += samples.size();
+}
+
+static void PutLE(unsigned char* p, uint32_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) { p[i] = (unsigned char)(value >> (i * 8)); }
+}
+
+// 16-bit mono PCM, rewritten with the real sizes when the file is closed
+void SimAudio::WriteHeader(uint32_t dataBytes) {
+	unsigned char header[44];
+	memcpy(header, "RIFF", 4);
+	PutLE(header + 4, 36 + dataBytes, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	PutLE(header + 16, 16, 4);
+	PutLE(header + 20, 1, 2);
+	PutLE(header + 22, 1, 2);
+	PutLE(header + 24, sampleRate, 4);
+	PutLE(header + 28, sampleRate * 2, 4);
+	PutLE(header + 32, 2, 2);
+	PutLE(header + 34, 16, 2);
+	memcpy(header + 36, "data", 4);
+	PutLE(header + 40, dataBytes, 4);
+	fseek(wav, 0, SEEK_SET);
+	if (fwrite(header, 1, sizeof(header), wav) != sizeof(header)) { writeErrors++; }
+	fseek(wav, 0, SEEK_END);
+}
+
+// Live playback
+// -------------
+
+// Device side: linear interpolation through the ring at a rate that speeds up when
+// the ring holds more than the target latency and slows down when it holds less
+void SimAudio::Play(int16_t* out, int samples) {
+	for (int i = 0; i < samples; i++) {
+		uint32_t available = ring.Available();
+		if (buffering && available >= (uint32_t)latency) { buffering = false; }
+		if (!buffering && available < 2) {
+			buffering = true;
+			underruns++;
+		}
+		if (buffering) {
+			out[i] = lastSample;
+			continue;
+		}
+		int first = ring.Peek(0);
+		int second = ring.Peek(1);
+		lastSample = (int16_t)(first + (second - first) * position);
+		out[i] = lastSample;
+		position += step;
+		uint32_t whole = (uint32_t)position;
+		if (whole > available - 1) { whole = available - 1; }
+		ring.Skip(whole);
+		position -= whole;
+		if (position >= 1.0) { position = 0.0; }
+	}
+
+	// Steer towards the rate that keeps the ring at the target latency
+	double fill = (double)ring.Available() / latency;
+	double target = deviceStep * (fill < 0.5 ? 0.5 : fill > 2.0 ? 2.0 : fill);
+	step += (target - step) * 0.05;
+	playbackRate = (float)(step / deviceStep);
+}
+
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+void SimAudio::DeviceCallback(void* user, unsigned char* stream, int length) {
+	((SimAudio*)user)->Play((int16_t*)stream, length / (int)sizeof(int16_t));
+}
+
+// Call with the simulation stopped, samples are queued for playback while enabled
+bool SimAudio::OpenDevice() {
+	CloseDevice();
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		fprintf(stderr, "Audio: %s\n", SDL_GetError());
+		return false;
+	}
+	SDL_AudioSpec wanted, obtained;
+	SDL_zero(wanted);
+	wanted.freq = sampleRate;
+	wanted.format = AUDIO_S16SYS;
+	wanted.channels = 1;
+	wanted.samples = 512;
+	wanted.callback = DeviceCallback;
+	wanted.userdata = this;
+	device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (device == 0) {
+		fprintf(stderr, "Audio: %s\n", SDL_GetError());
+		return false;
+	}
+	deviceStep = (double)sampleRate / obtained.freq;
+	step = deviceStep;
+	position = 0.0;
+	buffering = true;
+	ring.Resize(latency * 4);
+	live = true;
+	SDL_PauseAudioDevice(device, 0);
+	return true;
+}
+
+// Closing waits for a running callback to finish
+void SimAudio::CloseDevice() {
+	if (device == 0) { return; }
+	live = false;
+	SDL_CloseAudioDevice(device);
+	device = 0;
+}
+#endif
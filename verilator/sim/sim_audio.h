@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Lock-free queue of samples between one producer and one consumer thread
+struct SimAudioRing {
+public:
+	void Resize(uint32_t capacity);		// Rounded up to a power of two, not thread safe
+	void Clear();						// Not thread safe
+
+	// Producer side, false if the ring is full and the sample was dropped
+	inline bool Push(int16_t sample) {
+		uint32_t position = head.load(std::memory_order_relaxed);
+		if (position - tail.load(std::memory_order_acquire) > mask) { return false; }
+		buffer[position & mask] = sample;
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side
+	uint32_t Available() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed); }
+	int16_t Peek(uint32_t offset) { return buffer[(tail.load(std::memory_order_relaxed) + offset) & mask]; }
+	void Skip(uint32_t count) { tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+	SimAudioRing();
+
+private:
+	std::vector<int16_t> buffer;
+	uint32_t mask;
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+};
+
+// Decimates the core's audio output from the system clock down to sampleRate.
+// Each output sample is the average of the system clock samples since the
+// previous one (a box filter with a fractional length), which only costs an
+// add and a compare per clock.
+//
+// Samples can be streamed to a 16-bit mono WAV file: full blocks go to a
+// worker thread that writes the file and keeps a CRC32 of the PCM data for
+// regression checks. In the GUI they can also be played live through SDL.
+// As the simulation rarely runs at real time, playback is resampled with a
+// rate steered by how full the ring is, and underruns/overruns are counted.
+struct SimAudio {
+public:
+	bool enabled;				// Clock() is only called while this is set
+	int clockRate;				// Rate of Clock() calls in Hz
+	int sampleRate;				// Output rate in Hz
+	int inputBits;				// Width of the core's audio output
+	std::string wavFile;
+	int blockSize;				// Samples per block handed to the worker
+	int queueLimit;				// Blocks waiting for the worker before the simulation blocks
+
+	long samplesWritten;
+	uint32_t checksum;			// CRC32 of the PCM data written so far
+	long writeErrors;
+
+	int latency;						// Samples kept in the ring for live playback
+	std::atomic<long> underruns;		// Times playback ran out of samples
+	std::atomic<long> overruns;			// Times the ring was full and samples were dropped
+	std::atomic<float> playbackRate;	// Current resampling rate relative to real time
+
+	inline void Clock(uint32_t value);
+	bool Start();
+	void Stop();
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+	bool OpenDevice();
+	void CloseDevice();
+#endif
+
+	SimAudio();
+	~SimAudio();
+
+private:
+	uint32_t sum;
+	uint32_t count;
+	uint32_t phase;
+	std::vector<int16_t> block;
+	bool writing;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable queueChanged;
+	std::deque<std::vector<int16_t>> queue;
+	std::vector<std::vector<int16_t>> spare;
+	bool stopping;
+	FILE* wav;
+
+	// Live playback, the ring is filled by the simulation and drained by the device callback
+	SimAudioRing ring;
+	std::atomic<bool> live;
+	bool overrunning;
+	uint32_t device;
+	double deviceStep;			// Ring samples per device sample at real time
+	double step;
+	double position;			// Fraction of the way from the ring's first sample to its second
+	bool buffering;				// Waiting for the ring to refill after an underrun
+	int16_t lastSample;
+
+	void Emit();
+	void Flush();
+	void Run();
+	void Write(const std::vector<int16_t>& samples);
+	void WriteHeader(uint32_t dataBytes);
+	void Play(int16_t* out, int samples);
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+	static void DeviceCallback(void* user, unsigned char* stream, int length);
+#endif
+};
+
+// Called once per system clock with the core's audio output
+inline void SimAudio::Clock(uint32_t value) {
+	sum += value;
+	count++;
+	phase += sampleRate;
+	if (phase >= (uint32_t)clockRate) { Emit(); }
+}
@@ -0,0 +1,248 @@
+#include "sim_break.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef SIM_HEADLESS
+#include "imgui.h"
+#endif
+
+const SimBreak_Region SimBreak_Regions[] = {
+	{ "RAM", 0x0000, 0x3FFF, true, false },
+	{ "POKEY", 0x4000, 0x47FF, true, false },
+	{ "IN0", 0x4800, 0x48FF, true, false },
+	{ "OUT", 0x4800, 0x48FF, false, true },
+	{ "IN1", 0x4900, 0x49FF, true, false },
+	{ "IN2", 0x4A00, 0x4AFF, true, false },
+	{ "COLRAM", 0x4B00, 0x4BFF, false, true },
+	{ "WDOG", 0x4C00, 0x4C00, false, true },
+	{ "INTACK", 0x4D00, 0x4D00, false, true },
+	{ "ROM", 0x5000, 0x7FFF, true, false }
+};
+const int SimBreak_RegionCount = sizeof(SimBreak_Regions) / sizeof(SimBreak_Regions[0]);
+
+static const char* kind_names[8] = { "", "pc", "read", "pc+read", "write", "pc+write", "access", "all" };
+static const char* condition_names[4] = { "always", "hit ==", "hit >=", "every" };
+
+SimBreak::SimBreak() {
+	newKind = 0;
+	strcpy(newAddress, "");
+	newCondition = break_always;
+	newCount = 1;
+	strcpy(newValue, "");
+	hitAddress = 0;
+	hitData = 0;
+	hitKind = 0;
+	Clear();
+}
+
+bool SimBreak::Add(const SimBreak_Point& point) {
+	if (point.kind <= 0 || point.kind > (break_pc | break_read | break_write) || point.end < point.start) { return false; }
+	points.push_back(point);
+	Rebuild();
+	return true;
+}
+
+// Adds a point from text: ADDR, ADDR-END or a region name (hex addresses, a region
+// also covers its mirror, write only regions only take write points), then
+// optionally =VV to only stop on that data byte and :N to only stop on hit N
+bool SimBreak::Add(int kind, const std::string& text) {
+	SimBreak_Point point;
+	point.kind = kind;
+	point.condition = break_always;
+	point.count = 1;
+	point.value = -1;
+	point.mirrored = false;
+	point.enabled = true;
+	point.hits = 0;
+
+	std::string range = text.substr(0, text.find_first_of("=:"));
+	bool found = false;
+	for (int i = 0; i < SimBreak_RegionCount; i++) {
+		if (strcmp(range.c_str(), SimBreak_Regions[i].name) == 0) {
+			if (SimBreak_Regions[i].writeOnly && kind != break_write) { return false; }
+			point.start = SimBreak_Regions[i].start;
+			point.end = SimBreak_Regions[i].end;
+			point.mirrored = SimBreak_Regions[i].mirrored;
+			found = true;
+		}
+	}
+	if (!found) {
+		char* end;
+		unsigned long start = strtoul(range.c_str(), &end, 16);
+		unsigned long last = start;
+		if (*end == '-') { last = strtoul(end + 1, &end, 16); }
+		if (range.empty() || *end != 0 || start > 0xFFFF || last > 0xFFFF) { return false; }
+		point.start = (uint16_t)start;
+		point.end = (uint16_t)last;
+	}
+
+	size_t value = text.find('=');
+	if (value != std::string::npos) {
+		char* end;
+		point.value = (int)strtoul(text.c_str() + value + 1, &end, 16);
+		if (*end != 0 && *end != ':') { return false; }
+		if (point.value > 0xFF) { return false; }
+	}
+	size_t count = text.find(':');
+	if (count != std::string::npos) {
+		point.condition = break_equal;
+		point.count = atol(text.c_str() + count + 1);
+		if (point.count < 1) { return false; }
+	}
+	return Add(point);
+}
+
+void SimBreak::Remove(int index) {
+	if (index < 0 || index >= (int)points.size()) { return; }
+	points.erase(points.begin() + index);
+	if (hit == index) { hit = -1; }
+	else if (hit > index) { hit--; }
+	Rebuild();
+}
+
+void SimBreak::Clear() {
+	points.clear();
+	hit = -1;
+	Rebuild();
+}
+
+void SimBreak::ResetHits() {
+	for (SimBreak_Point& point : points) { point.hits = 0; }
+	hit = -1;
+}
+
+// Sets the map from the enabled points, called whenever a point changes
+void SimBreak::Rebuild() {
+	memset(map, 0, sizeof(map));
+	active = false;
+	for (const SimBreak_Point& point : points) {
+		if (!point.enabled) { continue; }
+		for (int address = point.start; address <= point.end; address++) {
+			map[address] |= point.kind;
+			if (point.mirrored) { map[address | 0x8000] |= point.kind; }
+		}
+		active = true;
+	}
+}
+
+std::string SimBreak::Describe(int index) {
+	const SimBreak_Point& point = points[index];
+	char text[96];
+	int length = snprintf(text, sizeof(text), "%s %04X", kind_names[point.kind], point.start);
+	if (point.end != point.start) { length += snprintf(text + length, sizeof(text) - length, "-%04X", point.end); }
+	if (point.mirrored) { length += snprintf(text + length, sizeof(text) - length, " +8000"); }
+	if (point.value >= 0) { length += snprintf(text + length, sizeof(text) - length, " =%02X", point.value); }
+	if (point.condition != break_always) { snprintf(text + length, sizeof(text) - length, " %s %ld", condition_names[point.condition], point.count); }
+	return text;
+}
+
+// The address is watched for this kind of cycle: count hits on the points that
+// match and stop on the first whose condition is met
+bool SimBreak::Match(uint16_t address, int kind, uint8_t data) {
+	bool stop = false;
+	for (int i = 0; i < (int)points.size(); i++) {
+		SimBreak_Point& point = points[i];
+		uint16_t decoded = point.mirrored ? address & 0x7FFF : address;
+		if (!point.enabled || !(point.kind & kind) || decoded < point.start || decoded > point.end) { continue; }
+		if (point.value >= 0 && point.value != data) { continue; }
+		point.hits++;
+		bool met;
+		switch (point.condition) {
+		case break_equal: met = point.hits == point.count; break;
+		case break_atLeast: met = point.hits >= point.count; break;
+		case break_every: met = point.hits % point.count == 0; break;
+		default: met = true; break;
+		}
+		if (met && !stop) {
+			stop = true;
+			hit = i;
+			hitAddress = address;
+			hitData = data;
+			hitKind = point.kind & kind;
+		}
+	}
+	return stop;
+}
+
+#ifndef SIM_HEADLESS
+void SimBreak::Draw(const char* title, bool* open) {
+	ImGui::SetNextWindowSize(ImVec2(480, 320), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin(title, open)) {
+		ImGui::End();
+		return;
+	}
+
+	// New point
+	static const char* new_kinds[] = { "PC", "Read", "Write", "Access" };
+	static const int new_kind_bits[] = { break_pc, break_read, break_write, break_read | break_write };
+	ImGui::SetNextItemWidth(80);
+	ImGui::Combo("##kind", &newKind, new_kinds, 4);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(110);
+	ImGui::InputTextWithHint("##address", "ADDR[-END]", newAddress, sizeof(newAddress), ImGuiInputTextFlags_CharsUppercase);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(50);
+	ImGui::InputTextWithHint("##value", "data", newValue, sizeof(newValue), ImGuiInputTextFlags_CharsHexadecimal);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(80);
+	ImGui::Combo("##condition", &newCondition, condition_names, 4);
+	if (newCondition != break_always) {
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(80);
+		ImGui::InputInt("##count", &newCount);
+		if (newCount < 1) { newCount = 1; }
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Add")) {
+		std::string text = newAddress;
+		if (newValue[0]) { text += std::string("=") + newValue; }
+		if (Add(new_kind_bits[newKind], text)) {
+			points.back().condition = newCondition;
+			points.back().count = newCount;
+			newAddress[0] = 0;
+		}
+	}
+
+	// Regions as decoded by missile.v, clicking one fills in its range
+	ImGui::TextUnformatted("Regions:");
+	for (int i = 0; i < SimBreak_RegionCount; i++) {
+		ImGui::SameLine();
+		if (ImGui::SmallButton(SimBreak_Regions[i].name)) { snprintf(newAddress, sizeof(newAddress), "%s", SimBreak_Regions[i].name); }
+	}
+
+	if (hit >= 0) {
+		ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.3f, 1.0f), "Stopped by %s: %s %04X data %02X", Describe(hit).c_str(),
+			kind_names[hitKind], hitAddress, hitData);
+	}
+	if (ImGui::Button("Reset hits")) { ResetHits(); }
+	ImGui::SameLine();
+	if (ImGui::Button("Clear all")) { Clear(); }
+
+	int remove = -1;
+	bool changed = false;
+	if (ImGui::BeginTable("points", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("On", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableSetupColumn("Point", ImGuiTableColumnFlags_WidthStretch);
+		ImGui::TableSetupColumn("Hits", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableHeadersRow();
+		for (int i = 0; i < (int)points.size(); i++) {
+			ImGui::PushID(i);
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			changed |= ImGui::Checkbox("##enabled", &points[i].enabled);
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(Describe(i).c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%ld", points[i].hits);
+			ImGui::TableNextColumn();
+			if (ImGui::SmallButton("X")) { remove = i; }
+			ImGui::PopID();
+		}
+		ImGui::EndTable();
+	}
+	if (changed) { Rebuild(); }
+	if (remove >= 0) { Remove(remove); }
+	ImGui::End();
+}
+#endif
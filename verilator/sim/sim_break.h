@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// What a point stops on, also the bits kept per address in SimBreak::map
+enum SimBreak_Kind {
+	break_pc = 1,		// Opcode fetch (sync) from the address
+	break_read = 2,		// Any read cycle, opcode fetches included
+	break_write = 4		// Write cycle
+};
+
+// Which hits stop the sim, counted from 1
+enum SimBreak_Condition {
+	break_always,		// Every hit
+	break_equal,		// Only hit number count
+	break_atLeast,		// Hit number count and every one after it
+	break_every			// Every count'th hit
+};
+
+struct SimBreak_Point {
+	int kind;			// SimBreak_Kind bits
+	uint16_t start;
+	uint16_t end;		// Inclusive
+	int condition;		// SimBreak_Condition
+	long count;
+	int value;			// Data byte that must be read or written, -1 for any
+	bool mirrored;		// A15 ignored, so the range also matches at +$8000
+	bool enabled;
+	long hits;
+};
+
+// Regions of the 6502 address space as decoded by missile.v. RAM, POKEY, IN0-2
+// and ROM ignore A15, so they are mirrored at +$8000 (the ROM copy holds the
+// vectors at $FFFA-$FFFF). OUT and COLRAM are decoded on A15-A8 and WDOG and
+// INTACK on the full address, so those only respond at their own address. IN0
+// shares its page with the OUT latch. OUT, COLRAM, WDOG and INTACK are only
+// selected by write cycles (s_mem_write), so they can't be watched for reads.
+struct SimBreak_Region {
+	const char* name;
+	uint16_t start;
+	uint16_t end;
+	bool mirrored;
+	bool writeOnly;
+};
+
+extern const SimBreak_Region SimBreak_Regions[];
+extern const int SimBreak_RegionCount;
+
+// PC breakpoints and read/write watchpoints. Every enabled point sets its kind
+// bits over its address range in a 64K map, so each CPU cycle is one lookup
+// however many points there are. The points are only searched (for hit counts
+// and data values) when the map says the address is watched.
+struct SimBreak {
+public:
+	bool active;			// Any point enabled, checked before Cycle() is called
+	int hit;				// Point that stopped the sim, -1 if none has
+	uint16_t hitAddress;
+	uint8_t hitData;
+	int hitKind;
+
+	inline bool Cycle(uint16_t address, bool read, bool sync, uint8_t data);
+	bool Add(const SimBreak_Point& point);
+	bool Add(int kind, const std::string& text);
+	void Remove(int index);
+	void Clear();
+	void ResetHits();
+	void Rebuild();
+	std::string Describe(int index);
+#ifndef SIM_HEADLESS
+	void Draw(const char* title, bool* open);
+#endif
+
+	SimBreak();
+
+private:
+	uint8_t map[0x10000];
+	std::vector<SimBreak_Point> points;
+
+	// GUI entry fields
+	int newKind;
+	char newAddress[32];
+	int newCondition;
+	int newCount;
+	char newValue[8];
+
+	bool Match(uint16_t address, int kind, uint8_t data);
+};
+
+// Called once per CPU cycle with the cycle's bus state, true if a point stopped the sim
+inline bool SimBreak::Cycle(uint16_t address, bool read, bool sync, uint8_t data) {
+	int kind = !read ? break_write : sync ? break_pc | break_read : break_read;
+	if (!(map[address] & kind)) { return false; }
+	return Match(address, kind, data);
+}
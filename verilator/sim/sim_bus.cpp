@@ -18,37 +18,35 @@
 #endif
 
 
-static DebugConsole console;
-bool ioctl_active = false;
-bool ioctl_pending = false;
-FILE* ioctl_file = NULL;
-int ioctl_next_addr = -1;
-int ioctl_last_index = -1;
-
-
-IData* ioctl_addr = NULL;
-CData* ioctl_index = NULL;
-CData* ioctl_wait = NULL;
-CData* ioctl_download = NULL;
-CData* ioctl_upload = NULL;
-CData* ioctl_wr = NULL;
-CData* ioctl_dout = NULL;
-CData* ioctl_din = NULL;
-
-std::queue<SimBus_DownloadChunk> downloadQueue;
+static DebugConsole console(log_bus);
+
+// Read a whole file into the arena in one go, rather than drip-feeding it with fgetc
+bool SimBus::StageFile(std::string file, SimBus_DownloadChunk& chunk) {
+	FILE* f = fopen(file.c_str(), "rb");
+	if (!f) {
+		console.Log(log_error, "Cannot open file for download %s", file.c_str());
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	chunk.offset = arena.size();
+	arena.resize(chunk.offset + (size > 0 ? size : 0));
+	chunk.length = size > 0 ? fread(arena.data() + chunk.offset, 1, size, f) : 0;
+	arena.resize(chunk.offset + chunk.length);
+	fclose(f);
+	return true;
+}
 
 void SimBus::QueueDownload(std::string file, int index, long address) {
 	SimBus_DownloadChunk chunk = SimBus_DownloadChunk(file, index, address);
-	downloadQueue.push(chunk);
-}
-void SimBus::QueueDownload(std::string file, int index, long address, bool restart) {
-	SimBus_DownloadChunk chunk = SimBus_DownloadChunk(file, index, address, restart);
-	downloadQueue.push(chunk);
+	if (StageFile(file, chunk)) { downloadQueue.push(chunk); }
 }
 bool SimBus::HasQueue() {
 	return downloadQueue.size() > 0;
 }
 
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <io.h> 
 #define access    _access_s
@@ -61,22 +59,89 @@ bool FileExists(const std::string& Filename)
 	return access(Filename.c_str(), 0) == 0;
 }
 
-int zip_search_by_crc(mz_zip_archive* zipArchive, uint32_t crc32, uint32_t* size)
+// Modification time and size identify a zip in the index cache
+static bool ZipIdentity(const std::string& path, long long& mtime, long long& size)
 {
-	for (unsigned int file_index = 0; file_index < zipArchive->m_total_files; file_index++)
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) { return false; }
+	mtime = (long long)st.st_mtime;
+	size = (long long)st.st_size;
+	return true;
+}
+
+// Returns the CRC index for a zip, scanning its directory only when the zip is new or has changed
+SimBus_ZipIndex* SimBus::IndexZip(std::string path)
+{
+	long long mtime, size;
+	if (!ZipIdentity(path, mtime, size)) { return NULL; }
+
+	std::map<std::string, SimBus_ZipIndex>::iterator cached = zipIndex.find(path);
+	if (cached != zipIndex.end() && cached->second.mtime == mtime && cached->second.size == size) {
+		return &cached->second;
+	}
+
+	mz_zip_archive archive;
+	memset(&archive, 0, sizeof(mz_zip_archive));
+	if (!mz_zip_reader_init_file(&archive, path.c_str(), 0)) {
+		console.Log(log_error, "Cannot open zip file: %s", path.c_str());
+		return NULL;
+	}
+	SimBus_ZipIndex& index = zipIndex[path];
+	index.mtime = mtime;
+	index.size = size;
+	index.entries.clear();
+	for (unsigned int file_index = 0; file_index < archive.m_total_files; file_index++)
 	{
 		mz_zip_archive_file_stat s;
-		if (mz_zip_reader_file_stat(zipArchive, file_index, &s))
+		if (mz_zip_reader_file_stat(&archive, file_index, &s))
 		{
-			if (s.m_crc32 == crc32)
-			{
-				*size = s.m_uncomp_size;
-				return file_index;
-			}
+			// First entry wins when several share a CRC
+			SimBus_ZipEntry entry = { (int)file_index, (uint32_t)s.m_uncomp_size };
+			index.entries.emplace(s.m_crc32, entry);
 		}
 	}
+	mz_zip_reader_end(&archive);
+	zipIndexDirty = true;
+	return &index;
+}
 
-	return -1;
+// Cache format: a "zip <mtime> <size> <count> <path>" line followed by count "<crc> <index> <size>" lines
+void SimBus::LoadZipIndex()
+{
+	zipIndexLoaded = true;
+	if (zipIndexFile.empty()) { return; }
+	std::ifstream in(zipIndexFile);
+	std::string tag;
+	while (in >> tag && tag == "zip") {
+		SimBus_ZipIndex index;
+		size_t count;
+		std::string path;
+		in >> index.mtime >> index.size >> count;
+		in.ignore(1);
+		std::getline(in, path);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t crc;
+			SimBus_ZipEntry entry;
+			in >> std::hex >> crc >> std::dec >> entry.fileIndex >> entry.size;
+			index.entries.emplace(crc, entry);
+		}
+		if (!in) { break; }
+		zipIndex[path] = index;
+	}
+}
+
+void SimBus::SaveZipIndex()
+{
+	if (zipIndexFile.empty() || !zipIndexDirty) { return; }
+	std::ofstream out(zipIndexFile);
+	for (std::map<std::string, SimBus_ZipIndex>::iterator z = zipIndex.begin(); z != zipIndex.end(); z++) {
+		out << "zip " << z->second.mtime << " " << z->second.size << " " << z->second.entries.size() << " " << z->first << "\n";
+		for (std::unordered_map<uint32_t, SimBus_ZipEntry>::iterator e = z->second.entries.begin(); e != z->second.entries.end(); e++) {
+			out << std::hex << e->first << std::dec << " " << e->second.fileIndex << " " << e->second.size << "\n";
+		}
+	}
+	if (out) { zipIndexDirty = false; }
+	else { console.Log(log_error, "Cannot write zip index cache: %s", zipIndexFile.c_str()); }
 }
 
 inline bool ends_with(std::string const& value, std::string const& ending)
@@ -85,7 +150,8 @@ inline bool ends_with(std::string const& value, std::string const& ending)
 	return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
-void SimBus::LoadMRA(std::string file) {
+// Queues every ROM part in the MRA, false if the MRA or any of its parts can't be read
+bool SimBus::LoadMRA(std::string file) {
 
 	rapidxml::xml_document<> doc;
 	rapidxml::xml_node<>* root_node = NULL;
@@ -100,8 +166,16 @@ void SimBus::LoadMRA(std::string file) {
 
 	// Find the root node
 	root_node = doc.first_node("misterromdescription");
+	if (root_node == NULL) {
+		console.Log(log_error, "Cannot load MRA file: %s", file.c_str());
+		return false;
+	}
 
-	int lastIndex = -1;
+	bool complete = true;
+	if (!zipIndexLoaded) { LoadZipIndex(); }
+
+	// Archives are opened at most once per MRA and closed when it has been staged
+	std::map<std::string, mz_zip_archive> archives;
 
 	// Iterate over the <rom> nodes
 	for (rapidxml::xml_node<>* rom_node = root_node->first_node("rom"); rom_node; rom_node = rom_node->next_sibling())
@@ -189,50 +263,61 @@ void SimBus::LoadMRA(std::string file) {
 					if (part_crc.length() > 0 && s != 0) {
 						// Find part in zip by crc
 						uint32_t crc32 = strtoul(part_crc.c_str(), NULL, 16);
-						for (int p = 0; p < zip_names.size(); p++) {
-							std::string zip_path = "roms\\" + zip_names[p];
-							mz_zip_archive* archive = new mz_zip_archive;
-							memset(archive, 0, sizeof(mz_zip_archive));
-							if (mz_zip_reader_init_file(archive, zip_path.c_str(), 0))
-							{
-								//console.AddLog("Searching ROM part from file %s by CRC (%s)", zip_path.c_str(), part_crc.c_str());
-								uint32_t size;
-								int fileIndex = zip_search_by_crc(archive, crc32, &size);
-								if (fileIndex >= 0) {
-									//console.AddLog("Loading ROM part from file %s by CRC (%s)", zip_path.c_str(), part_crc.c_str());
-
-									char* buffer = new char[size_t(size)];
-									mz_zip_reader_extract_to_mem(archive, fileIndex, buffer, size, 0);
-
-									std::string label = part_name;
-									label.append(" (");
-									label.append(part_crc);
-									label.append(")");
-									if (part_length > 0) {
-										size = part_length;
-									}
-									SimBus_DownloadChunk chunk = SimBus_DownloadChunk(indexValue, address, label);
-
-									for (int b = part_offset; b < size + part_offset; b++) {
-										chunk.contentQueue.push(buffer[b]);
-									}
-									downloadQueue.push(chunk);
-
-									partFound = true;
-									break;
+						for (int p = 0; p < zip_names.size() && !partFound; p++) {
+							std::string zip_path = romPath + zip_names[p];
+							SimBus_ZipIndex* zip = IndexZip(zip_path);
+							if (zip == NULL) { continue; }
+							std::unordered_map<uint32_t, SimBus_ZipEntry>::iterator found = zip->entries.find(crc32);
+							if (found == zip->entries.end()) { continue; }
+							//console.AddLog("Loading ROM part from file %s by CRC (%s)", zip_path.c_str(), part_crc.c_str());
+
+							std::map<std::string, mz_zip_archive>::iterator open = archives.find(zip_path);
+							if (open == archives.end()) {
+								open = archives.emplace(zip_path, mz_zip_archive()).first;
+								memset(&open->second, 0, sizeof(mz_zip_archive));
+								if (!mz_zip_reader_init_file(&open->second, zip_path.c_str(), 0)) {
+									console.Log(log_error, "Cannot open zip file: %s", zip_path.c_str());
+									archives.erase(open);
+									continue;
 								}
 							}
-							mz_zip_reader_end(archive);
+
+							// Extract straight into the arena, then trim to the requested span
+							uint32_t size = found->second.size;
+							size_t start = arena.size();
+							arena.resize(start + size);
+							if (mz_zip_reader_extract_to_mem(&open->second, found->second.fileIndex, arena.data() + start, size, 0)) {
+								std::string label = part_name;
+								label.append(" (");
+								label.append(part_crc);
+								label.append(")");
+								SimBus_DownloadChunk chunk = SimBus_DownloadChunk(indexValue, address, label);
+								size_t skip = part_offset < size ? part_offset : size;
+								size_t length = size - skip;
+								if (part_length > 0 && part_length < length) {
+									length = part_length;
+								}
+								memmove(arena.data() + start, arena.data() + start + skip, length);
+								arena.resize(start + length);
+								chunk.offset = start;
+								chunk.length = length;
+								downloadQueue.push(chunk);
+								partFound = true;
+							}
+							else {
+								arena.resize(start);
+								console.Log(log_error, "Cannot extract ROM part %s from %s", part_name.c_str(), zip_path.c_str());
+							}
 						}
 					}
 
 					// Find rom part
 					if (!partFound) {
 						for (int p = 0; p < rom_names.size(); p++) {
-							std::string part_path = "roms/" + rom_names[p] + "/" + part_name;
+							std::string part_path = romPath + rom_names[p] + "/" + part_name;
 							if (FileExists(part_path)) {
 								//console.AddLog("Loading ROM part from file: %s", part_path.c_str());
-								QueueDownload(part_path, indexValue, address, lastIndex != indexValue);
+								QueueDownload(part_path, indexValue, address);
 								partFound = true;
 								break;
 							}
@@ -243,11 +328,11 @@ void SimBus::LoadMRA(std::string file) {
 						// Try primary rom folder with other subfolders
 
 						for (int p = 1; p < rom_names.size(); p++) {
-							std::string part_path = "roms/" + rom_names[0] + "/" + rom_names[p] + "/" + part_name;
+							std::string part_path = romPath + rom_names[0] + "/" + rom_names[p] + "/" + part_name;
 							//console.AddLog("Looking for ROM part from file: %s", part_path.c_str());
 							if (FileExists(part_path)) {
 								//console.AddLog("Loading ROM part from file: %s", part_path.c_str());
-								QueueDownload(part_path, indexValue, address, lastIndex != indexValue);
+								QueueDownload(part_path, indexValue, address);
 								partFound = true;
 								break;
 							}
@@ -255,7 +340,8 @@ void SimBus::LoadMRA(std::string file) {
 					}
 
 					if (!partFound) {
-						console.AddLog("Could not load ROM part in any known file: %s", part_name.c_str());
+						console.Log(log_error, "Could not load ROM part in any known file: %s", part_name.c_str());
+						complete = false;
 					}
 				}
 				else {
@@ -276,33 +362,35 @@ void SimBus::LoadMRA(std::string file) {
 						bytes.push_back(c);
 					}
 
+					chunk.offset = arena.size();
 					for (int r = 0; r < part_repeat; r++) {
-						for (int b = 0; b < bytes.size(); b++) {
-							chunk.contentQueue.push(bytes[b]);
-						}
+						arena.insert(arena.end(), bytes.begin(), bytes.end());
 					}
+					chunk.length = arena.size() - chunk.offset;
 
-					//console.AddLog("Creating ROM part repeat=%d  len=%d", part_repeat, chunk.contentQueue.size());
+					//console.AddLog("Creating ROM part repeat=%d  len=%d", part_repeat, chunk.length);
 					downloadQueue.push(chunk);
 				}
 
-
-				lastIndex = indexValue;
 			}
 		}
 	}
 
+	for (std::map<std::string, mz_zip_archive>::iterator a = archives.begin(); a != archives.end(); a++) {
+		mz_zip_reader_end(&a->second);
+	}
+	SaveZipIndex();
+	return complete;
 }
 
-int nextchar = 0;
 void SimBus::BeforeEval()
 {
-	if (!ioctl_active && downloadQueue.size() == 0) {
+	if (!ioctlActive && downloadQueue.size() == 0) {
 		// No queue, nothing to do
 		return;
 	}
 	// If no download is active and there is a download queued
-	if (!ioctl_active && downloadQueue.size() > 0) {
+	if (!ioctlActive && downloadQueue.size() > 0) {
 
 		// Get chunk from queue
 		currentDownload = downloadQueue.front();
@@ -310,96 +398,108 @@ void SimBus::BeforeEval()
 
 		// If last index differs from this one then reset the addresses
 		if (currentDownload.index != *ioctl_index) {
-			ioctl_next_addr = -1;
+			ioctlNextAddr = -1;
 			if (currentDownload.address != 0) {
-				ioctl_next_addr = currentDownload.address;
+				ioctlNextAddr = currentDownload.address;
 			}
 		}
 		// Set address and index
 		*ioctl_index = currentDownload.index;
 
-		// Open file
-		if (!currentDownload.isQueue) {
-			ioctl_file = fopen(currentDownload.file.c_str(), "rb");
-			if (!ioctl_file) {
-				console.AddLog("Cannot open file for download %s\n", currentDownload.file.c_str());
-			}
-			else {
-				ioctl_active = true;
-				console.AddLog("Starting download: %s %d index=%d", currentDownload.file.c_str(), *ioctl_addr, currentDownload.index);
-			}
-		}
-		else {
-			console.AddLog("Starting download: %s %d index=%d", currentDownload.label.c_str(), *ioctl_addr, currentDownload.index);
-			ioctl_active = true;
-			nextchar = currentDownload.contentQueue.front();
+		console.AddLog("Starting download: %s %d index=%d", currentDownload.label.c_str(), *ioctl_addr, currentDownload.index);
+		ioctlActive = true;
+		if (currentDownload.isQueue && currentDownload.length > 0) {
+			nextChar = arena[currentDownload.offset];
 		}
 	}
 	else
 	{
 		bool complete = false;
+		const unsigned char* data = arena.data() + currentDownload.offset;
 		if (!currentDownload.isQueue) {
-
-			if (ioctl_file) {
-				//console.AddLog("ioctl_download addr %x  ioctl_wait %x", *ioctl_addr, *ioctl_wait);
-
-				// Otherwise drip-feed it through HPS
-//					if (*ioctl_wait == 0) {
-				*ioctl_download = 1;
-				*ioctl_wr = 1;
-				if (feof(ioctl_file)) {
-					fclose(ioctl_file);
-					ioctl_file = NULL;
-					ioctl_active = false;
-					*ioctl_download = 0;
-					*ioctl_wr = 0;
-					//console.AddLog("ioctl_download complete %d", ioctl_next_addr);
-				}
-				if (ioctl_file) {
-					int curchar = fgetc(ioctl_file);
-					if (feof(ioctl_file) == 0) {
-						nextchar = curchar;
-						ioctl_next_addr++;
-					}
-				}
-				//				}
+			// Files are fed a byte every cycle, with one extra write of the last
+			// byte before the download ends (as the old fgetc/feof loop did)
+			*ioctl_download = 1;
+			*ioctl_wr = 1;
+			if (currentDownload.position > currentDownload.length) {
+				complete = true;
 			}
 			else {
-				complete = true;
+				if (currentDownload.position < currentDownload.length) {
+					nextChar = data[currentDownload.position];
+					ioctlNextAddr++;
+				}
+				currentDownload.position++;
 			}
-
 		}
 		else {
 			// Do a queue
-			//console.AddLog("ioctl: active=%d download=%d wr=%d next_addr=%d", ioctl_active, *ioctl_download, *ioctl_wr, *ioctl_addr);
-			if (currentDownload.contentQueue.empty()) {
+			//console.AddLog("ioctl: active=%d download=%d wr=%d next_addr=%d", ioctlActive, *ioctl_download, *ioctl_wr, *ioctl_addr);
+			if (currentDownload.position == currentDownload.length) {
 				complete = true;
-				ioctl_pending = false;
+				ioctlPending = false;
 			}
 			else {
 				*ioctl_download = 1;
 				*ioctl_wr = 1;
-				if (!ioctl_pending) {
-					nextchar = currentDownload.contentQueue.front();
-					currentDownload.contentQueue.pop();
-					ioctl_next_addr++;
-					ioctl_pending = true;
+				if (!ioctlPending) {
+					nextChar = data[currentDownload.position++];
+					ioctlNextAddr++;
+					ioctlPending = true;
 				}
 				else {
-					ioctl_pending = false;
+					ioctlPending = false;
 				}
 			}
 		}
 
-		*ioctl_addr = ioctl_next_addr;
-		*ioctl_dout = (unsigned char)nextchar;
+		*ioctl_addr = ioctlNextAddr;
+		*ioctl_dout = (unsigned char)nextChar;
 
 		if (complete) {
-			ioctl_active = false;
+			ioctlActive = false;
 			*ioctl_download = 0;
 			*ioctl_wr = 0;
+			// Everything has been fed to the core, so the staged ROM data can go
+			if (downloadQueue.empty()) {
+				std::vector<unsigned char>().swap(arena);
+			}
+		}
+	}
+}
+
+// Hand the queued chunks for index straight to write() instead of feeding them
+// through the ioctl protocol. Addresses follow the same sequence BeforeEval would
+// produce, and only chunks at the front of the queue are taken so any that follow
+// still download with the addresses they would otherwise get.
+long SimBus::Backdoor(int index, const std::function<void(long address, unsigned char data)>& write)
+{
+	long count = 0;
+	while (!ioctlActive && downloadQueue.size() > 0 && downloadQueue.front().index == index) {
+		SimBus_DownloadChunk chunk = downloadQueue.front();
+		downloadQueue.pop();
+
+		if (chunk.index != *ioctl_index) {
+			ioctlNextAddr = -1;
+			if (chunk.address != 0) {
+				ioctlNextAddr = chunk.address;
+			}
 		}
+		*ioctl_index = chunk.index;
+
+		console.AddLog("Backdoor load: %s index=%d", chunk.label.c_str(), chunk.index);
+		const unsigned char* data = arena.data() + chunk.offset;
+		for (size_t b = 0; b < chunk.length; b++) {
+			ioctlNextAddr++;
+			write(ioctlNextAddr, data[b]);
+		}
+		if (chunk.length > 0) { nextChar = data[chunk.length - 1]; }
+		count += chunk.length;
+	}
+	if (downloadQueue.empty()) {
+		std::vector<unsigned char>().swap(arena);
 	}
+	return count;
 }
 
 void SimBus::AfterEval()
@@ -407,9 +507,74 @@ void SimBus::AfterEval()
 
 }
 
+static void SaveChunk(VerilatedSerialize& os, SimBus_DownloadChunk& chunk) {
+	os << chunk.file << chunk.label << chunk.isQueue;
+	os.write(&chunk.address, sizeof(chunk.address));
+	os.write(&chunk.index, sizeof(chunk.index));
+	vluint64_t span[3] = { chunk.offset, chunk.length, chunk.position };
+	os.write(span, sizeof(span));
+}
+
+static void RestoreChunk(VerilatedDeserialize& os, SimBus_DownloadChunk& chunk) {
+	os >> chunk.file >> chunk.label >> chunk.isQueue;
+	os.read(&chunk.address, sizeof(chunk.address));
+	os.read(&chunk.index, sizeof(chunk.index));
+	vluint64_t span[3];
+	os.read(span, sizeof(span));
+	chunk.offset = span[0];
+	chunk.length = span[1];
+	chunk.position = span[2];
+}
+
+void SimBus::Save(VerilatedSerialize& os)
+{
+	os << ioctlActive << ioctlPending;
+	os.write(&ioctlNextAddr, sizeof(ioctlNextAddr));
+	os.write(&ioctlLastIndex, sizeof(ioctlLastIndex));
+	os.write(&nextChar, sizeof(nextChar));
+	SaveChunk(os, currentDownload);
+
+	std::queue<SimBus_DownloadChunk> queue = downloadQueue;
+	vluint32_t count = queue.size();
+	os << count;
+	while (!queue.empty()) {
+		SaveChunk(os, queue.front());
+		queue.pop();
+	}
+
+	// The arena is released once downloads finish, so this is empty after startup
+	vluint64_t size = arena.size();
+	os.write(&size, sizeof(size));
+	if (size) { os.write(arena.data(), size); }
+}
+
+void SimBus::Restore(VerilatedDeserialize& os)
+{
+	os >> ioctlActive >> ioctlPending;
+	os.read(&ioctlNextAddr, sizeof(ioctlNextAddr));
+	os.read(&ioctlLastIndex, sizeof(ioctlLastIndex));
+	os.read(&nextChar, sizeof(nextChar));
+	RestoreChunk(os, currentDownload);
+
+	downloadQueue = std::queue<SimBus_DownloadChunk>();
+	vluint32_t count;
+	os >> count;
+	for (vluint32_t i = 0; i < count; i++) {
+		SimBus_DownloadChunk chunk;
+		RestoreChunk(os, chunk);
+		downloadQueue.push(chunk);
+	}
+
+	vluint64_t size;
+	os.read(&size, sizeof(size));
+	arena.resize(size);
+	if (size) { os.read(arena.data(), size); }
+}
+
 
 SimBus::SimBus(DebugConsole c) {
-	console = c;
+	// DebugConsole state is shared, and the bus is constructed during static
+	// initialisation before this file's console exists, so don't copy c here
 	ioctl_addr = NULL;
 	ioctl_index = NULL;
 	ioctl_wait = NULL;
@@ -418,6 +583,15 @@ SimBus::SimBus(DebugConsole c) {
 	ioctl_wr = NULL;
 	ioctl_dout = NULL;
 	ioctl_din = NULL;
+	romPath = SimBus_DefaultRomPath;
+	zipIndexFile = "";
+	zipIndexLoaded = false;
+	zipIndexDirty = false;
+	ioctlActive = false;
+	ioctlPending = false;
+	ioctlNextAddr = -1;
+	ioctlLastIndex = -1;
+	nextChar = 0;
 }
 
 SimBus::~SimBus() {
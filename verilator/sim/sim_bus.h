@@ -1,6 +1,11 @@
 #pragma once
+#include <functional>
+#include <map>
 #include <queue>
+#include <unordered_map>
+#include <vector>
 #include "verilated_heavy.h"
+#include "verilated_save.h"
 #include "sim_console.h"
 
 
@@ -9,36 +14,36 @@
 #define WIN32
 #endif
 
+const char* const SimBus_DefaultRomPath = "roms/";
+
 struct SimBus_DownloadChunk {
 public:
 	std::string file;
-	std::queue<char> contentQueue;
 	std::string label;
 	long address;
-	bool isQueue;
+	bool isQueue;		// In-memory part, fed one byte every other cycle (files feed one byte every cycle)
 	int index;
-	
+	size_t offset;		// Span of the chunk's bytes in the bus arena
+	size_t length;
+	size_t position;	// Bytes fed to the core so far
+
 	SimBus_DownloadChunk() {
 		file = "";
 		index = -1;
+		address = 0;
+		isQueue = false;
+		offset = 0;
+		length = 0;
+		position = 0;
 	}
 
-	SimBus_DownloadChunk(std::string file, int index, long address) {
-		this->file = std::string(file);
-		this->label = std::string(file);
-		this->index = index;
-		this->isQueue = false;
-		this->address = address;
-	}
-	SimBus_DownloadChunk(std::string file, int index, long address, bool restart) {
+	SimBus_DownloadChunk(std::string file, int index, long address) : SimBus_DownloadChunk() {
 		this->file = std::string(file);
 		this->label = std::string(file);
 		this->index = index;
-		this->isQueue = false;
 		this->address = address;
 	}
-	SimBus_DownloadChunk(int index, long address, std::string label) {
-		this->contentQueue = std::queue<char>();
+	SimBus_DownloadChunk(int index, long address, std::string label) : SimBus_DownloadChunk() {
 		this->index = index;
 		this->isQueue = true;
 		this->label = std::string(label);
@@ -46,6 +51,18 @@ public:
 	}
 };
 
+struct SimBus_ZipEntry {
+	int fileIndex;
+	uint32_t size;
+};
+
+// CRC lookup for one zip, valid while the zip's modification time and size match
+struct SimBus_ZipIndex {
+	long long mtime;
+	long long size;
+	std::unordered_map<uint32_t, SimBus_ZipEntry> entries;
+};
+
 struct SimBus {
 public:
 
@@ -58,12 +75,17 @@ public:
 	CData* ioctl_dout;
 	CData* ioctl_din;
 
+	std::string romPath;		// Folder holding the zips and loose ROM folders
+	std::string zipIndexFile;	// Optional file the zip CRC indexes are persisted to
+
 	void BeforeEval(void);
 	void AfterEval(void);
 	void QueueDownload(std::string file, int index, long address);
-	void QueueDownload(std::string file, int index, long address, bool restart);
 	bool HasQueue();
-	void LoadMRA(std::string file);
+	long Backdoor(int index, const std::function<void(long address, unsigned char data)>& write);
+	bool LoadMRA(std::string file);
+	void Save(VerilatedSerialize& os);
+	void Restore(VerilatedDeserialize& os);
 
 	SimBus(DebugConsole c);
 	~SimBus();
@@ -71,5 +93,18 @@ public:
 private:
 	std::queue<SimBus_DownloadChunk> downloadQueue;
 	SimBus_DownloadChunk currentDownload;
+	std::vector<unsigned char> arena;	// Contents of every queued chunk, back to back
+	std::map<std::string, SimBus_ZipIndex> zipIndex;
+	bool zipIndexLoaded;
+	bool zipIndexDirty;
+	bool ioctlActive;		// Download in progress
+	bool ioctlPending;
+	int ioctlNextAddr;
+	int ioctlLastIndex;
+	int nextChar;
 	void SetDownload(std::string file, int index);
+	bool StageFile(std::string file, SimBus_DownloadChunk& chunk);
+	SimBus_ZipIndex* IndexZip(std::string path);
+	void LoadZipIndex();
+	void SaveZipIndex();
 };
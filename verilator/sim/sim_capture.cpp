@@ -0,0 +1,203 @@
+#include "sim_capture.h"
+#include <string.h>
+#include <sys/stat.h>
+
+#include "inc/miniz.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+SimCapture::SimCapture() {
+	queueLimit = 8;
+	pngLevel = MZ_BEST_SPEED;
+	framesCaptured = 0;
+	framesCompared = 0;
+	firstMismatch = -1;
+	mismatchGolden = 0;
+	mismatchHash = 0;
+	writeErrors = 0;
+	width = 0;
+	height = 0;
+	running = false;
+	stopping = false;
+	manifest = NULL;
+	y4m = NULL;
+}
+
+SimCapture::~SimCapture() {
+	Stop();
+}
+
+bool SimCapture::Enabled() {
+	return !pngFolder.empty() || !y4mFile.empty() || !manifestFile.empty() || !goldenFile.empty();
+}
+
+bool SimCapture::LoadGolden() {
+	FILE* file = fopen(goldenFile.c_str(), "r");
+	if (!file) { return false; }
+	int frame;
+	unsigned int hash;
+	while (fscanf(file, "%d %x%*[^\n]", &frame, &hash) == 2) { golden[frame] = hash; }
+	fclose(file);
+	return !golden.empty();
+}
+
+bool SimCapture::Start(int width, int height) {
+	Stop();
+	this->width = width;
+	this->height = height;
+	framesCaptured = 0;
+	framesCompared = 0;
+	firstMismatch = -1;
+	goldenMissing = 0;
+	firstMissing = -1;
+	writeErrors = 0;
+	golden.clear();
+	reached.clear();
+
+	if (!goldenFile.empty() && !LoadGolden()) {
+		fprintf(stderr, "Cannot read golden manifest, or it has no frames: %s\n", goldenFile.c_str());
+		return false;
+	}
+	if (!pngFolder.empty()) {
+#ifdef _WIN32
+		_mkdir(pngFolder.c_str());
+#else
+		mkdir(pngFolder.c_str(), 0755);
+#endif
+	}
+	if (!manifestFile.empty()) {
+		manifest = fopen(manifestFile.c_str(), "w");
+		if (!manifest) { fprintf(stderr, "Cannot write capture manifest: %s\n", manifestFile.c_str()); return false; }
+	}
+	if (!y4mFile.empty()) {
+		y4m = fopen(y4mFile.c_str(), "wb");
+		if (!y4m) { fprintf(stderr, "Cannot write Y4M stream: %s\n", y4mFile.c_str()); Stop(); return false; }
+		fprintf(y4m, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", width, height);
+		planes.resize((size_t)width * height * 3);
+	}
+
+	stopping = false;
+	running = true;
+	worker = std::thread(&SimCapture::Run, this);
+	return true;
+}
+
+// Called by the simulation at the falling edge of vblank with the completed frame
+void SimCapture::Capture(int frame, const uint32_t* pixels) {
+	if (!running) { return; }
+	std::unique_lock<std::mutex> lock(mutex);
+	queueChanged.wait(lock, [this] { return (int)queue.size() < queueLimit; });
+	SimCapture_Frame captured;
+	captured.frame = frame;
+	if (!spare.empty()) {
+		captured.pixels = std::move(spare.back());
+		spare.pop_back();
+	}
+	captured.pixels.assign(pixels, pixels + (size_t)width * height);
+	queue.push_back(std::move(captured));
+	lock.unlock();
+	queueChanged.notify_all();
+}
+
+// Drains the queue, then closes the outputs
+void SimCapture::Stop() {
+	if (running) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		worker.join();
+		running = false;
+	}
+	if (manifest) { fclose(manifest); manifest = NULL; }
+	if (y4m) { fclose(y4m); y4m = NULL; }
+
+	// A run that stops before the end of the golden manifest hasn't matched it
+	goldenMissing = 0;
+	firstMissing = -1;
+	for (const std::pair<const int, uint32_t>& expected : golden) {
+		if (reached.count(expected.first)) { continue; }
+		if (firstMissing < 0) { firstMissing = expected.first; }
+		goldenMissing++;
+	}
+}
+
+void SimCapture::Run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		queueChanged.wait(lock, [this] { return !queue.empty() || stopping; });
+		if (queue.empty()) { break; }
+		SimCapture_Frame frame = std::move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+		queueChanged.notify_all();
+
+		Process(frame);
+
+		lock.lock();
+		spare.push_back(std::move(frame.pixels));
+	}
+}
+
+void SimCapture::Process(const SimCapture_Frame& frame) {
+	uint32_t hash = (uint32_t)mz_crc32(MZ_CRC32_INIT, (const unsigned char*)frame.pixels.data(), frame.pixels.size() * sizeof(uint32_t));
+	framesCaptured++;
+	if (manifest) { fprintf(manifest, "%d %08x\n", frame.frame, hash); }
+
+	std::map<int, uint32_t>::iterator expected = golden.find(frame.frame);
+	if (expected != golden.end()) {
+		framesCompared++;
+		reached.insert(frame.frame);
+		if (expected->second != hash && firstMismatch < 0) {
+			firstMismatch = frame.frame;
+			mismatchGolden = expected->second;
+			mismatchHash = hash;
+		}
+	}
+
+	if (!pngFolder.empty()) { WritePng(frame); }
+	if (y4m) { WriteY4m(frame); }
+}
+
+void SimCapture::WritePng(const SimCapture_Frame& frame) {
+	// Pixels are stored R, G, B, A in memory, alpha is dropped
+	std::vector<unsigned char> rgb((size_t)width * height * 3);
+	const unsigned char* source = (const unsigned char*)frame.pixels.data();
+	for (size_t i = 0, count = frame.pixels.size(); i < count; i++) {
+		memcpy(&rgb[i * 3], source + i * 4, 3);
+	}
+	size_t length = 0;
+	void* png = tdefl_write_image_to_png_file_in_memory_ex(rgb.data(), width, height, 3, &length, pngLevel, MZ_FALSE);
+	char name[32];
+	snprintf(name, sizeof(name), "/frame_%06d.png", frame.frame);
+	FILE* file = png ? fopen((pngFolder + name).c_str(), "wb") : NULL;
+	if (!file || fwrite(png, 1, length, file) != length) { writeErrors++; }
+	if (file) { fclose(file); }
+	mz_free(png);
+}
+
+static unsigned char Clamp8(int value) {
+	return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// Full range BT.601 4:4:4, a Y4M stream can't hold RGB so this is the one lossy output (see --capture-png)
+void SimCapture::WriteY4m(const SimCapture_Frame& frame) {
+	size_t count = frame.pixels.size();
+	unsigned char* y = planes.data();
+	unsigned char* u = y + count;
+	unsigned char* v = u + count;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t pixel = frame.pixels[i];
+		int r = pixel & 0xFF;
+		int g = (pixel >> 8) & 0xFF;
+		int b = (pixel >> 16) & 0xFF;
+		y[i] = Clamp8((77 * r + 150 * g + 29 * b + 128) >> 8);
+		u[i] = Clamp8(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+		v[i] = Clamp8(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128);
+	}
+	fputs("FRAME\n", y4m);
+	if (fwrite(planes.data(), 1, planes.size(), y4m) != planes.size()) { writeErrors++; }
+}
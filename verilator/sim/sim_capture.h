@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SimCapture_Frame {
+	int frame;
+	std::vector<uint32_t> pixels;
+};
+
+// Records completed video frames without slowing the simulation: frames are
+// copied into a bounded queue and a worker thread hashes them (CRC32 of the
+// RGBA buffer), writes the manifest, encodes PNG files or a Y4M stream and
+// compares against a golden manifest. Capture only blocks when the worker falls
+// more than queueLimit frames behind, so no frame is ever dropped.
+struct SimCapture {
+public:
+	std::string pngFolder;		// Write frame_NNNNNN.png files here
+	std::string y4mFile;		// Write a 4:4:4 Y4M stream here
+	std::string manifestFile;	// Write "frame crc32" lines here
+	std::string goldenFile;		// Compare hashes with this manifest
+	int queueLimit;				// Frames waiting for the worker before Capture blocks
+	int pngLevel;				// Deflate level for PNG files
+
+	long framesCaptured;
+	long framesCompared;
+	int firstMismatch;			// Frame number of the first hash that differs from the golden manifest, -1 if none
+	uint32_t mismatchGolden;
+	uint32_t mismatchHash;
+	long goldenMissing;			// Golden manifest frames the run never reached, set by Stop()
+	int firstMissing;			// Earliest of them, -1 if none
+	long writeErrors;
+
+	bool Enabled();
+	bool Start(int width, int height);
+	void Capture(int frame, const uint32_t* pixels);
+	void Stop();
+
+	SimCapture();
+	~SimCapture();
+
+private:
+	int width;
+	int height;
+	bool running;
+	bool stopping;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable queueChanged;
+	std::deque<SimCapture_Frame> queue;
+	std::vector<std::vector<uint32_t>> spare;	// Recycled pixel buffers
+	std::map<int, uint32_t> golden;
+	std::set<int> reached;		// Golden frames that were compared
+	FILE* manifest;
+	FILE* y4m;
+	std::vector<unsigned char> planes;
+
+	bool LoadGolden();
+	void Run();
+	void Process(const SimCapture_Frame& frame);
+	void WritePng(const SimCapture_Frame& frame);
+	void WriteY4m(const SimCapture_Frame& frame);
+};
@@ -27,3 +27,13 @@ void SimClock::Reset() {
 	clk = false;
 	old = false;
 }
+
+void SimClock::Save(VerilatedSerialize& os) {
+	os << clk << old;
+	os.write(&count, sizeof(count));
+}
+
+void SimClock::Restore(VerilatedDeserialize& os) {
+	os >> clk >> old;
+	os.read(&count, sizeof(count));
+}
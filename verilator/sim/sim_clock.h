@@ -1,4 +1,5 @@
 #pragma once
+#include "verilated_save.h"
 
 class SimClock
 {
@@ -10,6 +11,8 @@ public:
 	~SimClock();
 	void Tick();
 	void Reset();
+	void Save(VerilatedSerialize& os);
+	void Restore(VerilatedDeserialize& os);
 
 private:
 	int ratio, count;
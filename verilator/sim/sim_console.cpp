@@ -1,5 +1,93 @@
 #include "sim_console.h"
 #include <string>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// Shared by every copy, unless the calling thread has its own
+static DebugConsole_Output SharedOutput = { NULL, NULL, NULL };
+static thread_local DebugConsole_Output* ThreadOutput = NULL;
+
+static DebugConsole_Output& Output() { return ThreadOutput ? *ThreadOutput : SharedOutput; }
+
+static void StoreLine(int severity, const char* text, int length, vluint64_t time, FILE* file);
+
+// Formats a line, hands it to the sink and keeps it for the window (or prints it headless)
+static void AddLine(int severity, int source, const char* fmt, va_list args)
+{
+	char buf[1024];
+	int length = vsnprintf(buf, sizeof(buf), fmt, args);
+	if (length < 0) { return; }
+	if (length > (int)sizeof(buf) - 1) { length = (int)sizeof(buf) - 1; }
+	// One row per line, so the window's clipper can work out which are visible
+	while (length > 0 && buf[length - 1] == '\n') { length--; }
+	buf[length] = 0;
+	DebugConsole_Output& output = Output();
+	vluint64_t time = output.time ? *output.time : 0;
+	if (output.sink) { output.sink->Push(time, severity, source, buf, length); }
+	StoreLine(severity, buf, length, time, output.file);
+}
+
+void DebugConsole::AddLog(const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	AddLine(log_info, source, fmt, args);
+	va_end(args);
+}
+
+void DebugConsole::Log(SimLog_Severity severity, const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	AddLine(severity, source, fmt, args);
+	va_end(args);
+}
+
+void DebugConsole::SetTime(const vluint64_t* time)
+{
+	Output().time = time;
+}
+
+void DebugConsole::SetSink(SimLog* sink)
+{
+	Output().sink = sink;
+}
+
+void DebugConsole::SetThreadOutput(DebugConsole_Output* output)
+{
+	ThreadOutput = output;
+}
+
+#ifdef SIM_HEADLESS
+
+// Headless builds have no console window, so log lines go straight to stdout
+static void StoreLine(int severity, const char* text, int length, vluint64_t time, FILE* file)
+{
+	if (!file) { file = stdout; }
+	fputs(text, file);
+	fputc('\n', file);
+}
+
+long DebugConsole::Dropped()
+{
+	return 0;
+}
+
+DebugConsole::DebugConsole(int source)
+{
+	this->source = source;
+}
+
+DebugConsole::~DebugConsole()
+{
+}
+
+void DebugConsole::ClearLog()
+{
+}
+
+#else
 #include "imgui.h"
 
 // Demonstrate creating a simple console window, with scrolling, filtering, completion and history.
@@ -14,24 +102,67 @@ bool                  AutoScroll;
 bool                  ScrollToBottom;
 
 
-ImVector<char*>       Items;
 static char* Strdup(const char* str) { size_t len = strlen(str) + 1; void* buf = malloc(len); IM_ASSERT(buf); return (char*)memcpy(buf, (const void*)str, len); }
 
+// Log ring
+struct DebugConsole_Line {
+	vluint64_t time;
+	unsigned int offset;	// Text in LogArena, NUL terminated
+	unsigned short length;
+	unsigned short severity;
+};
+const unsigned int LogArenaSize = 1 << 22;
+const unsigned int LogLineCapacity = 1 << 16;
+static char LogArena[LogArenaSize];
+static DebugConsole_Line LogLines[LogLineCapacity];
+static unsigned int LogFirst = 0;			// Oldest line
+static unsigned int LogCount = 0;
+static unsigned int LogWrite = 0;			// Where the next line's text goes in the arena
+static long LogDropped = 0;
+
+static DebugConsole_Line& LogLine(unsigned int index) { return LogLines[(LogFirst + index) & (LogLineCapacity - 1)]; }
+
+static void DropOldest()
+{
+	LogFirst = (LogFirst + 1) & (LogLineCapacity - 1);
+	LogCount--;
+	LogDropped++;
+}
+
+static void StoreLine(int severity, const char* text, int length, vluint64_t time, FILE* file)
+{
+	// Text is written round the arena in order, so the lines in the way are always the oldest.
+	// Going back to the start leaves the lines after the write position, which are older still.
+	unsigned int size = (unsigned int)length + 1;
+	if (LogCount == 0) { LogWrite = 0; }
+	if (LogWrite + size > LogArenaSize) {
+		while (LogCount > 0 && LogLine(0).offset >= LogWrite) { DropOldest(); }
+		LogWrite = 0;
+	}
+	while (LogCount > 0) {
+		const DebugConsole_Line& oldest = LogLine(0);
+		if (oldest.offset >= LogWrite + size || oldest.offset + oldest.length + 1 <= LogWrite) { break; }
+		DropOldest();
+	}
+	if (LogCount == LogLineCapacity) { DropOldest(); }
+
+	DebugConsole_Line& line = LogLine(LogCount++);
+	line.time = time;
+	line.offset = LogWrite;
+	line.length = (unsigned short)length;
+	line.severity = (unsigned short)severity;
+	memcpy(LogArena + LogWrite, text, size);
+	LogWrite += size;
+}
 
-void DebugConsole::AddLog(const char* fmt, ...) IM_FMTARGS(2)
+long DebugConsole::Dropped()
 {
-	// FIXME-OPT
-	char buf[1024];
-	va_list args;
-	va_start(args, fmt);
-	vsnprintf(buf, IM_ARRAYSIZE(buf), fmt, args);
-	buf[IM_ARRAYSIZE(buf) - 1] = 0;
-	va_end(args);
-	Items.push_back(Strdup(buf));
+	return LogDropped;
 }
 
-DebugConsole::DebugConsole()
+DebugConsole::DebugConsole(int source)
 {
+	this->source = source;
 	ClearLog();
 	memset(InputBuf, 0, sizeof(InputBuf));
 	HistoryPos = -1;
@@ -56,9 +187,29 @@ static void  Strtrim(char* str) { char* str_end = str + strlen(str); while (str_
 
 void DebugConsole::ClearLog()
 {
-	for (int i = 0; i < Items.Size; i++)
-		free(Items[i]);
-	Items.clear();
+	LogFirst = 0;
+	LogCount = 0;
+	LogWrite = 0;
+}
+
+static void DrawLines(int start, int end)
+{
+	for (int i = start; i < end; i++)
+	{
+		const DebugConsole_Line& line = LogLine(i);
+		const char* item = LogArena + line.offset;
+		if (!Filter.PassFilter(item, item + line.length))
+			continue;
+
+		bool pop_color = false;
+		if (line.severity == log_error || strstr(item, "[error]")) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f)); pop_color = true; }
+		else if (line.severity == log_warning) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.3f, 1.0f)); pop_color = true; }
+		else if (strncmp(item, "# ", 2) == 0) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.6f, 1.0f)); pop_color = true; }
+		if (SharedOutput.time) { ImGui::Text("(%llu) %s", (unsigned long long)line.time, item); }
+		else { ImGui::TextUnformatted(item, item + line.length); }
+		if (pop_color)
+			ImGui::PopStyleColor();
+	}
 }
 
 void DebugConsole::Draw(const char* title, bool* p_open)
@@ -85,6 +236,8 @@ void DebugConsole::Draw(const char* title, bool* p_open)
 
 	if (ImGui::SmallButton("Clear")) { ClearLog(); } ImGui::SameLine();
 	bool copy_to_clipboard = ImGui::SmallButton("Copy");
+	ImGui::SameLine();
+	ImGui::TextDisabled("%u lines, %ld dropped", LogCount, LogDropped);
 
 	ImGui::Separator();
 
@@ -110,33 +263,19 @@ void DebugConsole::Draw(const char* title, bool* p_open)
 		ImGui::EndPopup();
 	}
 
-	// Display every line as a separate entry so we can change their color or add custom widgets. If you only want raw text you can use ImGui::TextUnformatted(log.begin(), log.end());
-	// NB- if you have thousands of entries this approach may be too inefficient and may require user-side clipping to only process visible items.
-	// You can seek and display only the lines that are visible using the ImGuiListClipper helper, if your elements are evenly spaced and you have cheap random access to the elements.
-	// To use the clipper we could replace the 'for (int i = 0; i < Items.Size; i++)' loop with:
-	//     ImGuiListClipper clipper(Items.Size);
-	//     while (clipper.Step())
-	//         for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
-	// However, note that you can not use this code as is if a filter is active because it breaks the 'cheap random-access' property. We would need random-access on the post-filtered list.
-	// A typical application wanting coarse clipping and filtering may want to pre-compute an array of indices that passed the filtering test, recomputing this array when user changes the filter,
-	// and appending newly elements as they are inserted. This is left as a task to the user until we can manage to improve this example code!
-	// If your items are of variable size you may want to implement code similar to what ImGuiListClipper does. Or split your data into fixed height items to allow random-seeking into your list.
+	// Lines are drawn through a clipper, so only the visible ones have their time formatted.
+	// A filter needs the text of every line, so filtered views (and copies) walk the whole ring.
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 1)); // Tighten spacing
 	if (copy_to_clipboard)
 		ImGui::LogToClipboard();
-	for (int i = 0; i < Items.Size; i++)
+	if (copy_to_clipboard || Filter.IsActive())
+		DrawLines(0, (int)LogCount);
+	else
 	{
-		const char* item = Items[i];
-		if (!Filter.PassFilter(item))
-			continue;
-
-		// Normally you would store more information in your item (e.g. make Items[] an array of structure, store color/type etc.)
-		bool pop_color = false;
-		if (strstr(item, "[error]")) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f)); pop_color = true; }
-		else if (strncmp(item, "# ", 2) == 0) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.6f, 1.0f)); pop_color = true; }
-		ImGui::TextUnformatted(item);
-		if (pop_color)
-			ImGui::PopStyleColor();
+		ImGuiListClipper clipper;
+		clipper.Begin((int)LogCount);
+		while (clipper.Step())
+			DrawLines(clipper.DisplayStart, clipper.DisplayEnd);
 	}
 	if (copy_to_clipboard)
 		ImGui::LogFinish();
@@ -310,3 +449,4 @@ int     DebugConsole::TextEditCallback(ImGuiInputTextCallbackData* data)
 	}
 	return 0;
 };
+#endif
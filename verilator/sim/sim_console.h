@@ -1,16 +1,46 @@
 #pragma once
+#include <stdio.h>
 #include <string> 
+#ifndef SIM_HEADLESS
 #include "imgui.h"
+#else
+#define IM_FMTARGS(FMT)
+#endif
 #include "verilatedos.h"
+#include "sim_log.h"
 
+// Where lines are stamped from, handed to and (headless) printed to. A parallel
+// run (sim_headless --jobs) gives each instance its own, set for the thread running
+// the instance, so every console copy called on that thread writes to it. The GUI
+// ring below is shared and unlocked, so only the GUI's own threads may use it.
+struct DebugConsole_Output {
+	const vluint64_t* time;		// Lines are stamped with *time, 0 when NULL
+	SimLog* sink;				// Log file sink, NULL for none
+	FILE* file;					// Headless lines are printed here, stdout when NULL
+};
+
+// Log lines are kept in a fixed size ring: the text goes into an arena and the
+// oldest lines are dropped when it or the line index is full, so logging never
+// allocates and memory stays flat however long the sim runs. Each line is stamped
+// with the sim time, which is only formatted when the line is drawn. The state is
+// shared by every copy (the bus and the Verilator runtime each hold one), apart
+// from the source each copy tags its lines with. Lines also go to the log file
+// sink when one is set.
 struct DebugConsole {
 public:
-	std::string prefix;
+	int source;								// SimLog_Source
 	void AddLog(const char* fmt, ...) IM_FMTARGS(2);
-	DebugConsole();
+	void Log(SimLog_Severity severity, const char* fmt, ...) IM_FMTARGS(3);
+	void SetTime(const vluint64_t* time);	// Lines are stamped with *time as they are added
+	void SetSink(SimLog* sink);
+	static void SetThreadOutput(DebugConsole_Output* output);	// NULL goes back to the shared output
+	long Dropped();							// Lines lost from the front of the ring so far
+	DebugConsole(int source = log_sim);
 	~DebugConsole();
 	void ClearLog();
+#ifndef SIM_HEADLESS
 	void Draw(const char* title, bool* p_open);
 	void    ExecCommand(const char* command_line);
 	int     TextEditCallback(ImGuiInputTextCallbackData* data);
+#endif
 };
@@ -0,0 +1,270 @@
+#include "sim_cpuprofile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#ifndef SIM_HEADLESS
+#include "imgui.h"
+#endif
+
+const int SimCpuProfile_MaxDepth = 64;		// Deeper calls than this drop the outermost frame
+
+const uint8_t opcode_brk = 0x00;
+const uint8_t opcode_jsr = 0x20;
+const uint8_t opcode_rti = 0x40;
+const uint8_t opcode_rts = 0x60;
+
+SimCpuProfile::SimCpuProfile() {
+	enabled = false;
+	started = false;
+	addressCycles.resize(0x10000);
+	addressTicks.resize(0x10000);
+	routineSelf.resize(0x10000);
+	routineInclusive.resize(0x10000);
+	routineCalls.resize(0x10000);
+	Reset();
+}
+
+void SimCpuProfile::Reset() {
+	started = false;
+	ResetStack();
+	cycles = 0;
+	ticks = 0;
+	std::fill(addressCycles.begin(), addressCycles.end(), 0);
+	std::fill(addressTicks.begin(), addressTicks.end(), 0);
+	std::fill(routineSelf.begin(), routineSelf.end(), 0);
+	std::fill(routineInclusive.begin(), routineInclusive.end(), 0);
+	std::fill(routineCalls.begin(), routineCalls.end(), 0);
+	topAddresses.clear();
+	topRoutines.clear();
+	topInclusive.clear();
+}
+
+// Forgets the call stack, for when the CPU state jumps (reset, state load or rewind).
+// The routines on it keep the inclusive time they had so far.
+void SimCpuProfile::ResetStack() {
+	if (started) { routineInclusive = Inclusive(); }
+	pc = 0;
+	routine = 0;
+	started = false;
+	rootStart = 0;
+	pending = pending_none;
+	pendingReturn = 0;
+	lastTime = 0;
+	stack.clear();
+}
+
+// Opcode fetch: the previous instruction has finished, so where it went is known
+void SimCpuProfile::Instruction(uint16_t address, uint8_t opcode, bool interrupt) {
+	if (!started) {
+		started = true;
+		routine = address;
+		rootStart = ticks;
+	}
+	switch (pending) {
+	case pending_call: Push(address, false); break;
+	case pending_interrupt: Push(address, true); break;
+	case pending_return: Unwind(address); break;
+	default: break;
+	}
+	pc = address;
+
+	// An interrupt drops the opcode just fetched, it is fetched again after RTI
+	pending = pending_none;
+	if (interrupt) { pending = pending_interrupt; pendingReturn = address; }
+	else if (opcode == opcode_brk) { pending = pending_interrupt; pendingReturn = address + 2; }
+	else if (opcode == opcode_jsr) { pending = pending_call; pendingReturn = address + 3; }
+	else if (opcode == opcode_rts || opcode == opcode_rti) { pending = pending_return; }
+}
+
+void SimCpuProfile::Push(uint16_t address, bool interrupt) {
+	if ((int)stack.size() >= SimCpuProfile_MaxDepth) { stack.erase(stack.begin()); }
+	SimCpuProfile_Frame frame;
+	frame.caller = routine;
+	frame.returnAddress = pendingReturn;
+	frame.start = ticks;
+	frame.interrupt = interrupt;
+	stack.push_back(frame);
+	routine = address;
+	routineCalls[address]++;
+}
+
+// Returns to the frame that pushed this return address, if there is one
+void SimCpuProfile::Unwind(uint16_t address) {
+	int frame = (int)stack.size() - 1;
+	while (frame >= 0 && stack[frame].returnAddress != address) { frame--; }
+	if (frame < 0) { return; }
+	while ((int)stack.size() > frame) {
+		routineInclusive[routine] += ticks - stack.back().start;
+		routine = stack.back().caller;
+		stack.pop_back();
+	}
+}
+
+// Reads "ADDR NAME" or "NAME = ADDR" lines, hex addresses with an optional $ or 0x.
+// Blank lines and lines starting with ; or # are skipped.
+bool SimCpuProfile::LoadSymbols(const std::string& file) {
+	FILE* in = fopen(file.c_str(), "r");
+	if (!in) {
+		fprintf(stderr, "Cannot read symbol file: %s\n", file.c_str());
+		return false;
+	}
+	symbols.clear();
+	char line[256];
+	int number = 0;
+	bool valid = true;
+	while (fgets(line, sizeof(line), in)) {
+		number++;
+		char first[128], second[128], third[128];
+		int fields = sscanf(line, " %127s %127s %127s", first, second, third);
+		if (fields <= 0 || first[0] == ';' || first[0] == '#') { continue; }
+		const char* address = fields == 2 ? first : fields == 3 && strcmp(second, "=") == 0 ? third : NULL;
+		const char* name = fields == 2 ? second : first;
+		if (address && (address[0] == '$')) { address++; }
+		else if (address && address[0] == '0' && (address[1] == 'x' || address[1] == 'X')) { address += 2; }
+		char* end = NULL;
+		unsigned long value = address ? strtoul(address, &end, 16) : 0;
+		if (!address || *address == 0 || *end != 0 || value > 0xFFFF) {
+			fprintf(stderr, "Symbol file %s line %d is not a symbol: %s", file.c_str(), number, line);
+			valid = false;
+			break;
+		}
+		symbols.push_back(std::make_pair((uint16_t)value, std::string(name)));
+	}
+	fclose(in);
+	if (!valid) { symbols.clear(); }
+	std::sort(symbols.begin(), symbols.end());
+	return valid;
+}
+
+// Nearest symbol at or before the address as "name" or "name+N", empty if there is none
+std::string SimCpuProfile::Name(uint16_t address) {
+	auto after = std::upper_bound(symbols.begin(), symbols.end(), std::make_pair(address, std::string()),
+		[](const std::pair<uint16_t, std::string>& a, const std::pair<uint16_t, std::string>& b) { return a.first < b.first; });
+	if (after == symbols.begin()) { return ""; }
+	const std::pair<uint16_t, std::string>& symbol = *(after - 1);
+	if (symbol.first == address) { return symbol.second; }
+	return symbol.second + "+" + std::to_string(address - symbol.first);
+}
+
+// Addresses with the largest values, largest first, leaving out zeros
+std::vector<uint16_t> SimCpuProfile::Top(const std::vector<uint64_t>& values, int rows) {
+	std::vector<uint16_t> indexes;
+	for (int address = 0; address < 0x10000; address++) {
+		if (values[address] > 0) { indexes.push_back((uint16_t)address); }
+	}
+	size_t count = std::min(indexes.size(), (size_t)rows);
+	std::partial_sort(indexes.begin(), indexes.begin() + count, indexes.end(),
+		[&values](uint16_t a, uint16_t b) { return values[a] > values[b]; });
+	indexes.resize(count);
+	return indexes;
+}
+
+// Inclusive ticks per routine, with the routines still on the stack given their time so far
+std::vector<uint64_t> SimCpuProfile::Inclusive() {
+	std::vector<uint64_t> inclusive = routineInclusive;
+	uint16_t open = routine;
+	for (int frame = (int)stack.size() - 1; frame >= 0; frame--) {
+		inclusive[open] += ticks - stack[frame].start;
+		open = stack[frame].caller;
+	}
+	if (started) { inclusive[open] += ticks - rootStart; }
+	return inclusive;
+}
+
+bool SimCpuProfile::WriteReport(const std::string& file, int rows) {
+	FILE* out = fopen(file.c_str(), "w");
+	if (!out) {
+		fprintf(stderr, "Cannot write 6502 profile: %s\n", file.c_str());
+		return false;
+	}
+	std::vector<uint64_t> inclusive = Inclusive();
+
+	fprintf(out, "6502 profile: %llu cycles, %llu ticks (%.2f ticks/cycle)\n\n", (unsigned long long)cycles, (unsigned long long)ticks,
+		cycles > 0 ? (double)ticks / cycles : 0.0);
+	fprintf(out, "Hot addresses\n%12s %12s %7s %11s  %-6s %s\n", "ticks", "cycles", "share", "ticks/cyc", "addr", "symbol");
+	for (uint16_t address : Top(addressTicks, rows)) {
+		fprintf(out, "%12llu %12u %6.2f%% %11.2f  %04X   %s\n", (unsigned long long)addressTicks[address], addressCycles[address],
+			ticks > 0 ? addressTicks[address] * 100.0 / ticks : 0.0,
+			addressCycles[address] > 0 ? (double)addressTicks[address] / addressCycles[address] : 0.0, address, Name(address).c_str());
+	}
+	fprintf(out, "\nHot routines (self)\n%12s %7s %12s %7s %9s  %-6s %s\n", "self", "share", "inclusive", "share", "calls", "entry", "symbol");
+	for (uint16_t address : Top(routineSelf, rows)) {
+		fprintf(out, "%12llu %6.2f%% %12llu %6.2f%% %9u  %04X   %s\n", (unsigned long long)routineSelf[address],
+			ticks > 0 ? routineSelf[address] * 100.0 / ticks : 0.0, (unsigned long long)inclusive[address],
+			ticks > 0 ? inclusive[address] * 100.0 / ticks : 0.0, routineCalls[address], address, Name(address).c_str());
+	}
+	bool written = !ferror(out);
+	fclose(out);
+	return written;
+}
+
+#ifndef SIM_HEADLESS
+void SimCpuProfile::Draw(const char* title, bool* open) {
+	ImGui::SetNextWindowSize(ImVec2(520, 480), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin(title, open)) {
+		ImGui::End();
+		return;
+	}
+	bool wasEnabled = enabled;
+	ImGui::Checkbox("Enabled", &enabled);
+	if (enabled != wasEnabled) { ResetStack(); }
+	ImGui::SameLine();
+	if (ImGui::Button("Reset")) { Reset(); }
+	ImGui::SameLine();
+	ImGui::Text("%llu cycles, %.2f ticks/cycle, depth %d", (unsigned long long)cycles, cycles > 0 ? (double)ticks / cycles : 0.0, Depth());
+
+	// Sorting 64K entries every GUI frame isn't needed to watch the totals move
+	if (ImGui::GetFrameCount() % 30 == 0 || (topAddresses.empty() && cycles > 0)) {
+		topAddresses = Top(addressTicks, 32);
+		topRoutines = Top(routineSelf, 32);
+		topInclusive = Inclusive();
+	}
+
+	ImGui::TextUnformatted("Hot addresses");
+	if (ImGui::BeginTable("addresses", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0, 180))) {
+		ImGui::TableSetupColumn("Address");
+		ImGui::TableSetupColumn("Share");
+		ImGui::TableSetupColumn("Ticks/cycle");
+		ImGui::TableSetupColumn("Symbol", ImGuiTableColumnFlags_WidthStretch);
+		ImGui::TableHeadersRow();
+		for (uint16_t address : topAddresses) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%04X", address);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f%%", ticks > 0 ? addressTicks[address] * 100.0 / ticks : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", addressCycles[address] > 0 ? (double)addressTicks[address] / addressCycles[address] : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(Name(address).c_str());
+		}
+		ImGui::EndTable();
+	}
+
+	ImGui::TextUnformatted("Hot routines");
+	if (ImGui::BeginTable("routines", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0, 180))) {
+		ImGui::TableSetupColumn("Entry");
+		ImGui::TableSetupColumn("Self");
+		ImGui::TableSetupColumn("Inclusive");
+		ImGui::TableSetupColumn("Calls");
+		ImGui::TableSetupColumn("Symbol", ImGuiTableColumnFlags_WidthStretch);
+		ImGui::TableHeadersRow();
+		for (uint16_t address : topRoutines) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%04X", address);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f%%", ticks > 0 ? routineSelf[address] * 100.0 / ticks : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f%%", ticks > 0 ? topInclusive[address] * 100.0 / ticks : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%u", routineCalls[address]);
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(Name(address).c_str());
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct SimCpuProfile_Frame {
+	uint16_t caller;		// Routine that runs again after the return
+	uint16_t returnAddress;	// Where the RTS (or RTI for an interrupt) goes back to
+	uint64_t start;			// ticks when the called routine was entered
+	bool interrupt;
+};
+
+// What the last instruction does to the call stack, applied at the next opcode fetch
+enum SimCpuProfile_Pending {
+	pending_none,
+	pending_call,			// JSR
+	pending_interrupt,		// IRQ/NMI taken or BRK
+	pending_return			// RTS or RTI
+};
+
+// Where the game's 6502 code spends its time. Every CPU cycle is counted against
+// the instruction it belongs to in flat 64K arrays, both as a cycle and as the
+// sim ticks it took, so cycles stretched by the RTL (s_phi_extend while MADSEL
+// accesses video RAM) show up as extra ticks per cycle. A shadow call stack built
+// from JSR/RTS, interrupts and RTI attributes time to routines: self time to the
+// routine running, inclusive time to each routine when it returns. Returns are
+// matched against the return address pushed, so an RTS used as a computed jump
+// leaves the stack alone.
+struct SimCpuProfile {
+public:
+	bool enabled;
+	uint64_t cycles;		// Totals since the last Reset()
+	uint64_t ticks;
+
+	std::vector<uint32_t> addressCycles;		// Per instruction address
+	std::vector<uint64_t> addressTicks;
+	std::vector<uint64_t> routineSelf;			// Ticks per routine entry address
+	std::vector<uint64_t> routineInclusive;
+	std::vector<uint32_t> routineCalls;
+
+	inline void Cycle(uint16_t address, bool sync, uint8_t data, bool interrupt, uint64_t time);
+	void Reset();
+	void ResetStack();
+	int Depth() { return (int)stack.size(); }
+
+	bool LoadSymbols(const std::string& file);
+	std::string Name(uint16_t address);
+	std::vector<uint16_t> Top(const std::vector<uint64_t>& values, int rows);
+	std::vector<uint64_t> Inclusive();
+	bool WriteReport(const std::string& file, int rows);
+#ifndef SIM_HEADLESS
+	void Draw(const char* title, bool* open);
+#endif
+
+	SimCpuProfile();
+
+private:
+	uint16_t pc;					// Instruction being executed
+	uint16_t routine;				// Routine being executed
+	bool started;					// An opcode fetch has been seen since ResetStack()
+	uint64_t rootStart;				// ticks when the routine at the bottom of the stack started
+	int pending;					// SimCpuProfile_Pending
+	uint16_t pendingReturn;
+	uint64_t lastTime;
+	std::vector<SimCpuProfile_Frame> stack;
+	std::vector<std::pair<uint16_t, std::string>> symbols;	// Sorted by address
+
+	// Tables drawn in the GUI, only sorted every few frames
+	std::vector<uint16_t> topAddresses;
+	std::vector<uint16_t> topRoutines;
+	std::vector<uint64_t> topInclusive;
+
+	void Instruction(uint16_t address, uint8_t opcode, bool interrupt);
+	void Push(uint16_t address, bool interrupt);
+	void Unwind(uint16_t address);
+};
+
+// Called once per CPU cycle with the cycle's bus state and the sim time
+inline void SimCpuProfile::Cycle(uint16_t address, bool sync, uint8_t data, bool interrupt, uint64_t time) {
+	if (sync) { Instruction(address, data, interrupt); }
+	if (!started) { return; }
+	uint64_t elapsed = lastTime != 0 && time > lastTime ? time - lastTime : 0;
+	lastTime = time;
+	addressCycles[pc]++;
+	addressTicks[pc] += elapsed;
+	routineSelf[routine] += elapsed;
+	cycles++;
+	ticks += elapsed;
+}
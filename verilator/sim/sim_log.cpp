@@ -0,0 +1,127 @@
+#include "sim_log.h"
+#include <string.h>
+#include <chrono>
+
+const char* SimLog_SeverityNames[3] = { "info", "warning", "error" };
+const char* SimLog_SourceNames[3] = { "sim", "bus", "rtl" };
+
+SimLog::SimLog() {
+	binary = false;
+	capacity = 1 << 22;
+	written = 0;
+	dropped = 0;
+	writeErrors = 0;
+	mask = 0;
+	head = 0;
+	tail = 0;
+	stopping = false;
+	out = NULL;
+}
+
+SimLog::~SimLog() {
+	Stop();
+}
+
+bool SimLog::Start() {
+	Stop();
+	out = fopen(file.c_str(), binary ? "wb" : "w");
+	if (!out) {
+		fprintf(stderr, "Cannot write log file: %s\n", file.c_str());
+		return false;
+	}
+	if (binary) { fwrite(SimLog_Magic, 1, sizeof(SimLog_Magic), out); }
+	uint64_t size = 1;
+	while (size < (uint64_t)capacity) { size <<= 1; }
+	ring.assign(size, 0);
+	mask = size - 1;
+	head = 0;
+	tail = 0;
+	written = 0;
+	dropped = 0;
+	writeErrors = 0;
+	stopping = false;
+	worker = std::thread(&SimLog::Run, this);
+	return true;
+}
+
+// Writes out whatever is still in the ring and closes the file
+void SimLog::Stop() {
+	if (!out) { return; }
+	stopping = true;
+	worker.join();
+	fclose(out);
+	out = NULL;
+}
+
+void SimLog::CopyIn(uint64_t position, const void* data, int length) {
+	uint64_t offset = position & mask;
+	uint64_t first = ring.size() - offset < (uint64_t)length ? ring.size() - offset : (uint64_t)length;
+	memcpy(&ring[offset], data, first);
+	memcpy(&ring[0], (const unsigned char*)data + first, length - first);
+}
+
+void SimLog::CopyOut(uint64_t position, void* data, int length) {
+	uint64_t offset = position & mask;
+	uint64_t first = ring.size() - offset < (uint64_t)length ? ring.size() - offset : (uint64_t)length;
+	memcpy(data, &ring[offset], first);
+	memcpy((unsigned char*)data + first, &ring[0], length - first);
+}
+
+void SimLog::Push(uint64_t time, int severity, int source, const char* text, int length) {
+	if (!out) { return; }
+	if (length > 0xFFFF) { length = 0xFFFF; }
+	uint64_t position = head.load(std::memory_order_relaxed);
+	if (ring.size() - (position - tail.load(std::memory_order_acquire)) < (uint64_t)(SimLog_HeaderSize + length)) {
+		dropped++;
+		return;
+	}
+	unsigned char header[SimLog_HeaderSize];
+	for (int i = 0; i < 8; i++) { header[i] = (unsigned char)(time >> (i * 8)); }
+	header[8] = (unsigned char)severity;
+	header[9] = (unsigned char)source;
+	header[10] = (unsigned char)length;
+	header[11] = (unsigned char)(length >> 8);
+	CopyIn(position, header, SimLog_HeaderSize);
+	CopyIn(position + SimLog_HeaderSize, text, length);
+	head.store(position + SimLog_HeaderSize + length, std::memory_order_release);
+}
+
+// Writes every complete record in the ring, false if there were none
+bool SimLog::Drain() {
+	uint64_t position = tail.load(std::memory_order_relaxed);
+	uint64_t end = head.load(std::memory_order_acquire);
+	if (position == end) { return false; }
+	unsigned char header[SimLog_HeaderSize];
+	char text[0x10000];
+	while (position != end) {
+		CopyOut(position, header, SimLog_HeaderSize);
+		int length = header[10] | header[11] << 8;
+		if (binary) {
+			if (fwrite(header, 1, SimLog_HeaderSize, out) != SimLog_HeaderSize) { writeErrors++; }
+			CopyOut(position + SimLog_HeaderSize, text, length);
+			if (fwrite(text, 1, length, out) != (size_t)length) { writeErrors++; }
+		}
+		else {
+			uint64_t time = 0;
+			for (int i = 7; i >= 0; i--) { time = time << 8 | header[i]; }
+			CopyOut(position + SimLog_HeaderSize, text, length);
+			if (fprintf(out, "%llu %s %s: %.*s\n", (unsigned long long)time, SimLog_SeverityNames[header[8] % 3],
+				SimLog_SourceNames[header[9] % 3], length, text) < 0) { writeErrors++; }
+		}
+		written++;
+		position += SimLog_HeaderSize + length;
+	}
+	tail.store(position, std::memory_order_release);
+	return true;
+}
+
+// Polls rather than waiting on a condition variable, so Push() never takes a lock
+void SimLog::Run() {
+	while (true) {
+		bool finishing = stopping.load();
+		bool busy = Drain();
+		if (finishing && !busy) { break; }
+		if (!busy) { std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+	}
+	fflush(out);
+}
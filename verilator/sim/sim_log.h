@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum SimLog_Severity {
+	log_info,
+	log_warning,
+	log_error
+};
+
+// Which DebugConsole a line came from
+enum SimLog_Source {
+	log_sim,		// Harness (sim_main)
+	log_bus,		// ROM loading and the ioctl bus
+	log_rtl			// $display from the verilated model
+};
+
+extern const char* SimLog_SeverityNames[3];
+extern const char* SimLog_SourceNames[3];
+
+// Binary log: the magic, then one record per line, little endian
+//   u64 time, u8 severity, u8 source, u16 length, length bytes of text (no terminator)
+const char SimLog_Magic[8] = { 'S', 'I', 'M', 'L', 'O', 'G', '0', '1' };
+const int SimLog_HeaderSize = 12;
+
+// Writes log lines to a file from a background thread. Lines go through a
+// lock-free byte ring, so the simulation thread never waits for the disk: if
+// the ring is full the line is dropped and counted. Push() is for one producer
+// at a time (the GUI only logs while it holds the simulation mutex).
+struct SimLog {
+public:
+	std::string file;
+	bool binary;				// Structured binary records instead of text lines
+	int capacity;				// Ring size in bytes
+
+	long written;
+	std::atomic<long> dropped;	// Lines lost because the ring was full
+	long writeErrors;
+
+	bool Start();
+	void Stop();
+	void Push(uint64_t time, int severity, int source, const char* text, int length);
+
+	SimLog();
+	~SimLog();
+
+private:
+	std::vector<unsigned char> ring;
+	uint64_t mask;
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	std::atomic<bool> stopping;
+	std::thread worker;
+	FILE* out;
+
+	void CopyIn(uint64_t position, const void* data, int length);
+	void CopyOut(uint64_t position, void* data, int length);
+	bool Drain();
+	void Run();
+};
@@ -0,0 +1,86 @@
+#include "sim_movie.h"
+#include <inttypes.h>
+
+SimMovie::SimMovie() {
+	applied = 0;
+	next = 0;
+	recording = NULL;
+	lastInputs = 0;
+	lastJoystick = 0;
+	recorded = 0;
+}
+
+SimMovie::~SimMovie() {
+	Stop();
+}
+
+// Reads a movie for replay, false if the file can't be read or a line isn't an event
+bool SimMovie::Load(const std::string& file) {
+	FILE* movie = fopen(file.c_str(), "r");
+	if (!movie) {
+		fprintf(stderr, "Cannot read input movie: %s\n", file.c_str());
+		return false;
+	}
+	this->file = file;
+	events.clear();
+	next = 0;
+	applied = 0;
+	char line[256];
+	int number = 0;
+	bool valid = true;
+	while (fgets(line, sizeof(line), movie)) {
+		number++;
+		char key;
+		unsigned long long at;
+		unsigned int inputs, joystick;
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') { continue; }
+		if (sscanf(line, " %c %llu %x %x", &key, &at, &inputs, &joystick) != 4 || (key != 'f' && key != 't')) {
+			fprintf(stderr, "Input movie %s line %d is not an event: %s", file.c_str(), number, line);
+			valid = false;
+			break;
+		}
+		SimMovie_Event event;
+		event.key = key == 'f' ? movie_frame : movie_tick;
+		event.at = at;
+		event.inputs = (uint16_t)inputs;
+		event.joystick = (uint16_t)joystick;
+		events.push_back(event);
+	}
+	fclose(movie);
+	if (!valid) { events.clear(); }
+	return valid;
+}
+
+// Starts writing the inputs given to the core to a movie
+bool SimMovie::Record(const std::string& file) {
+	Stop();
+	recording = fopen(file.c_str(), "w");
+	if (!recording) {
+		fprintf(stderr, "Cannot write input movie: %s\n", file.c_str());
+		return false;
+	}
+	this->file = file;
+	recorded = 0;
+	fprintf(recording, "# Input movie: f frame / t tick, inputs, joystick_analog (hex)\n");
+	return true;
+}
+
+void SimMovie::Stop() {
+	if (!recording) { return; }
+	fclose(recording);
+	recording = NULL;
+}
+
+void SimMovie::Apply(uint16_t& inputs, uint16_t& joystick) {
+	const SimMovie_Event& event = events[next++];
+	inputs = event.inputs;
+	joystick = event.joystick;
+	applied++;
+}
+
+void SimMovie::Write(uint64_t tick, uint16_t inputs, uint16_t joystick) {
+	fprintf(recording, "t %" PRIu64 " %04x %04x\n", tick, inputs, joystick);
+	lastInputs = inputs;
+	lastJoystick = joystick;
+	recorded++;
+}
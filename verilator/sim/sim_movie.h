@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// When an event is applied: at the start of a video frame or at a sim tick (main_time)
+enum SimMovie_Key {
+	movie_frame,
+	movie_tick
+};
+
+struct SimMovie_Event {
+	SimMovie_Key key;
+	uint64_t at;
+	uint16_t inputs;		// top->inputs
+	uint16_t joystick;		// top->joystick_analog
+};
+
+// Input movie: the core's inputs as a list of changes, one per line of a text file
+//   f 240 0010 c13f		from video frame 240, inputs 0x0010 and joystick 0xc13f
+//   t 393218 0000 0000		from tick 393218
+// Recording writes a tick keyed line whenever the inputs change, so a replay
+// applies them on exactly the same cycle. Frame keyed lines are easier to write
+// by hand. Events are applied in file order, each once its frame or tick is reached.
+struct SimMovie {
+public:
+	std::string file;
+	long applied;			// Events replayed so far
+
+	bool Load(const std::string& file);
+	bool Record(const std::string& file);
+	void Stop();
+
+	bool Replaying() { return next < events.size(); }
+	inline bool Due(int frame, uint64_t tick);
+	void Apply(uint16_t& inputs, uint16_t& joystick);
+	inline void Changed(uint64_t tick, uint16_t inputs, uint16_t joystick);
+	int Count() { return (int)events.size(); }
+
+	SimMovie();
+	~SimMovie();
+
+private:
+	std::vector<SimMovie_Event> events;
+	size_t next;
+	FILE* recording;
+	uint16_t lastInputs;
+	uint16_t lastJoystick;
+	long recorded;
+
+	void Write(uint64_t tick, uint16_t inputs, uint16_t joystick);
+};
+
+// Checked every tick while replaying, so only the next event is looked at
+inline bool SimMovie::Due(int frame, uint64_t tick) {
+	if (next >= events.size()) { return false; }
+	const SimMovie_Event& event = events[next];
+	return event.key == movie_frame ? (uint64_t)frame >= event.at : tick >= event.at;
+}
+
+// Called with the inputs just given to the core, written out if they differ from the last ones
+inline void SimMovie::Changed(uint64_t tick, uint16_t inputs, uint16_t joystick) {
+	if (recording && (inputs != lastInputs || joystick != lastJoystick || recorded == 0)) { Write(tick, inputs, joystick); }
+}
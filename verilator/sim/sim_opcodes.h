@@ -0,0 +1,308 @@
+#pragma once
+#include <stdint.h>
+
+enum instruction_type {
+	implied,
+	immediate,
+	absolute,
+	absoluteX,
+	absoluteY,
+	zeroPage,
+	zeroPageX,
+	zeroPageY,
+	relative,
+	accumulator,
+	indirect,
+	indirectX,
+	indirectY
+};
+
+// Operand text for each addressing mode, in the same form as the MAME trace ("lda #$00").
+// The value is the operand byte, the 16 bit address for absolute and indirect modes,
+// or the branch target for relative.
+constexpr const char* SimOpcode_OperandFormats[] = {
+	"",				// implied
+	" #$%02x",		// immediate
+	" $%04x",		// absolute
+	" $%04x, x",	// absoluteX
+	" $%04x, y",	// absoluteY
+	" $%02x",		// zeroPage
+	" $%02x, x",	// zeroPageX
+	" $%02x, y",	// zeroPageY
+	" $%04x",		// relative
+	" a",			// accumulator
+	" ($%04x)",		// indirect
+	" ($%02x), x",	// indirectX
+	" ($%02x), y"	// indirectY
+};
+
+struct SimOpcode {
+	const char* mnemonic;
+	instruction_type mode;
+	uint8_t length;		// Bytes including the opcode
+
+	constexpr bool Known() const { return mnemonic[0] != '?'; }
+};
+
+// Every NMOS 6502 opcode, indexed by opcode. Undocumented opcodes are "???",
+// apart from 0x80 which MAME traces as a two byte nop.
+constexpr SimOpcode SimOpcodes[256] = {
+	{ "brk", implied, 1 },	// 00
+	{ "ora", indirectX, 2 },	// 01
+	{ "???", implied, 1 },	// 02
+	{ "???", implied, 1 },	// 03
+	{ "???", implied, 1 },	// 04
+	{ "ora", zeroPage, 2 },	// 05
+	{ "asl", zeroPage, 2 },	// 06
+	{ "???", implied, 1 },	// 07
+	{ "php", implied, 1 },	// 08
+	{ "ora", immediate, 2 },	// 09
+	{ "asl", accumulator, 1 },	// 0A
+	{ "???", implied, 1 },	// 0B
+	{ "???", implied, 1 },	// 0C
+	{ "ora", absolute, 3 },	// 0D
+	{ "asl", absolute, 3 },	// 0E
+	{ "???", implied, 1 },	// 0F
+	{ "bpl", relative, 2 },	// 10
+	{ "ora", indirectY, 2 },	// 11
+	{ "???", implied, 1 },	// 12
+	{ "???", implied, 1 },	// 13
+	{ "???", implied, 1 },	// 14
+	{ "ora", zeroPageX, 2 },	// 15
+	{ "asl", zeroPageX, 2 },	// 16
+	{ "???", implied, 1 },	// 17
+	{ "clc", implied, 1 },	// 18
+	{ "ora", absoluteY, 3 },	// 19
+	{ "???", implied, 1 },	// 1A
+	{ "???", implied, 1 },	// 1B
+	{ "???", implied, 1 },	// 1C
+	{ "ora", absoluteX, 3 },	// 1D
+	{ "asl", absoluteX, 3 },	// 1E
+	{ "???", implied, 1 },	// 1F
+	{ "jsr", absolute, 3 },	// 20
+	{ "and", indirectX, 2 },	// 21
+	{ "???", implied, 1 },	// 22
+	{ "???", implied, 1 },	// 23
+	{ "bit", zeroPage, 2 },	// 24
+	{ "and", zeroPage, 2 },	// 25
+	{ "rol", zeroPage, 2 },	// 26
+	{ "???", implied, 1 },	// 27
+	{ "plp", implied, 1 },	// 28
+	{ "and", immediate, 2 },	// 29
+	{ "rol", accumulator, 1 },	// 2A
+	{ "???", implied, 1 },	// 2B
+	{ "bit", absolute, 3 },	// 2C
+	{ "and", absolute, 3 },	// 2D
+	{ "rol", absolute, 3 },	// 2E
+	{ "???", implied, 1 },	// 2F
+	{ "bmi", relative, 2 },	// 30
+	{ "and", indirectY, 2 },	// 31
+	{ "???", implied, 1 },	// 32
+	{ "???", implied, 1 },	// 33
+	{ "???", implied, 1 },	// 34
+	{ "and", zeroPageX, 2 },	// 35
+	{ "rol", zeroPageX, 2 },	// 36
+	{ "???", implied, 1 },	// 37
+	{ "sec", implied, 1 },	// 38
+	{ "and", absoluteY, 3 },	// 39
+	{ "???", implied, 1 },	// 3A
+	{ "???", implied, 1 },	// 3B
+	{ "???", implied, 1 },	// 3C
+	{ "and", absoluteX, 3 },	// 3D
+	{ "rol", absoluteX, 3 },	// 3E
+	{ "???", implied, 1 },	// 3F
+	{ "rti", implied, 1 },	// 40
+	{ "eor", indirectX, 2 },	// 41
+	{ "???", implied, 1 },	// 42
+	{ "???", implied, 1 },	// 43
+	{ "???", implied, 1 },	// 44
+	{ "eor", zeroPage, 2 },	// 45
+	{ "lsr", zeroPage, 2 },	// 46
+	{ "???", implied, 1 },	// 47
+	{ "pha", implied, 1 },	// 48
+	{ "eor", immediate, 2 },	// 49
+	{ "lsr", accumulator, 1 },	// 4A
+	{ "???", implied, 1 },	// 4B
+	{ "jmp", absolute, 3 },	// 4C
+	{ "eor", absolute, 3 },	// 4D
+	{ "lsr", absolute, 3 },	// 4E
+	{ "???", implied, 1 },	// 4F
+	{ "bvc", relative, 2 },	// 50
+	{ "eor", indirectY, 2 },	// 51
+	{ "???", implied, 1 },	// 52
+	{ "???", implied, 1 },	// 53
+	{ "???", implied, 1 },	// 54
+	{ "eor", zeroPageX, 2 },	// 55
+	{ "lsr", zeroPageX, 2 },	// 56
+	{ "???", implied, 1 },	// 57
+	{ "cli", implied, 1 },	// 58
+	{ "eor", absoluteY, 3 },	// 59
+	{ "???", implied, 1 },	// 5A
+	{ "???", implied, 1 },	// 5B
+	{ "???", implied, 1 },	// 5C
+	{ "eor", absoluteX, 3 },	// 5D
+	{ "lsr", absoluteX, 3 },	// 5E
+	{ "???", implied, 1 },	// 5F
+	{ "rts", implied, 1 },	// 60
+	{ "adc", indirectX, 2 },	// 61
+	{ "???", implied, 1 },	// 62
+	{ "???", implied, 1 },	// 63
+	{ "???", implied, 1 },	// 64
+	{ "adc", zeroPage, 2 },	// 65
+	{ "ror", zeroPage, 2 },	// 66
+	{ "???", implied, 1 },	// 67
+	{ "pla", implied, 1 },	// 68
+	{ "adc", immediate, 2 },	// 69
+	{ "ror", accumulator, 1 },	// 6A
+	{ "???", implied, 1 },	// 6B
+	{ "jmp", indirect, 3 },	// 6C
+	{ "adc", absolute, 3 },	// 6D
+	{ "ror", absolute, 3 },	// 6E
+	{ "???", implied, 1 },	// 6F
+	{ "bvs", relative, 2 },	// 70
+	{ "adc", indirectY, 2 },	// 71
+	{ "???", implied, 1 },	// 72
+	{ "???", implied, 1 },	// 73
+	{ "???", implied, 1 },	// 74
+	{ "adc", zeroPageX, 2 },	// 75
+	{ "ror", zeroPageX, 2 },	// 76
+	{ "???", implied, 1 },	// 77
+	{ "sei", implied, 1 },	// 78
+	{ "adc", absoluteY, 3 },	// 79
+	{ "???", implied, 1 },	// 7A
+	{ "???", implied, 1 },	// 7B
+	{ "???", implied, 1 },	// 7C
+	{ "adc", absoluteX, 3 },	// 7D
+	{ "ror", absoluteX, 3 },	// 7E
+	{ "???", implied, 1 },	// 7F
+	{ "nop", immediate, 2 },	// 80
+	{ "sta", indirectX, 2 },	// 81
+	{ "???", implied, 1 },	// 82
+	{ "???", implied, 1 },	// 83
+	{ "sty", zeroPage, 2 },	// 84
+	{ "sta", zeroPage, 2 },	// 85
+	{ "stx", zeroPage, 2 },	// 86
+	{ "???", implied, 1 },	// 87
+	{ "dey", implied, 1 },	// 88
+	{ "???", implied, 1 },	// 89
+	{ "txa", implied, 1 },	// 8A
+	{ "???", implied, 1 },	// 8B
+	{ "sty", absolute, 3 },	// 8C
+	{ "sta", absolute, 3 },	// 8D
+	{ "stx", absolute, 3 },	// 8E
+	{ "???", implied, 1 },	// 8F
+	{ "bcc", relative, 2 },	// 90
+	{ "sta", indirectY, 2 },	// 91
+	{ "???", implied, 1 },	// 92
+	{ "???", implied, 1 },	// 93
+	{ "sty", zeroPageX, 2 },	// 94
+	{ "sta", zeroPageX, 2 },	// 95
+	{ "stx", zeroPageY, 2 },	// 96
+	{ "???", implied, 1 },	// 97
+	{ "tya", implied, 1 },	// 98
+	{ "sta", absoluteY, 3 },	// 99
+	{ "txs", implied, 1 },	// 9A
+	{ "???", implied, 1 },	// 9B
+	{ "???", implied, 1 },	// 9C
+	{ "sta", absoluteX, 3 },	// 9D
+	{ "???", implied, 1 },	// 9E
+	{ "???", implied, 1 },	// 9F
+	{ "ldy", immediate, 2 },	// A0
+	{ "lda", indirectX, 2 },	// A1
+	{ "ldx", immediate, 2 },	// A2
+	{ "???", implied, 1 },	// A3
+	{ "ldy", zeroPage, 2 },	// A4
+	{ "lda", zeroPage, 2 },	// A5
+	{ "ldx", zeroPage, 2 },	// A6
+	{ "???", implied, 1 },	// A7
+	{ "tay", implied, 1 },	// A8
+	{ "lda", immediate, 2 },	// A9
+	{ "tax", implied, 1 },	// AA
+	{ "???", implied, 1 },	// AB
+	{ "ldy", absolute, 3 },	// AC
+	{ "lda", absolute, 3 },	// AD
+	{ "ldx", absolute, 3 },	// AE
+	{ "???", implied, 1 },	// AF
+	{ "bcs", relative, 2 },	// B0
+	{ "lda", indirectY, 2 },	// B1
+	{ "???", implied, 1 },	// B2
+	{ "???", implied, 1 },	// B3
+	{ "ldy", zeroPageX, 2 },	// B4
+	{ "lda", zeroPageX, 2 },	// B5
+	{ "ldx", zeroPageY, 2 },	// B6
+	{ "???", implied, 1 },	// B7
+	{ "clv", implied, 1 },	// B8
+	{ "lda", absoluteY, 3 },	// B9
+	{ "tsx", implied, 1 },	// BA
+	{ "???", implied, 1 },	// BB
+	{ "ldy", absoluteX, 3 },	// BC
+	{ "lda", absoluteX, 3 },	// BD
+	{ "ldx", absoluteY, 3 },	// BE
+	{ "???", implied, 1 },	// BF
+	{ "cpy", immediate, 2 },	// C0
+	{ "cmp", indirectX, 2 },	// C1
+	{ "???", implied, 1 },	// C2
+	{ "???", implied, 1 },	// C3
+	{ "cpy", zeroPage, 2 },	// C4
+	{ "cmp", zeroPage, 2 },	// C5
+	{ "dec", zeroPage, 2 },	// C6
+	{ "???", implied, 1 },	// C7
+	{ "iny", implied, 1 },	// C8
+	{ "cmp", immediate, 2 },	// C9
+	{ "dex", implied, 1 },	// CA
+	{ "???", implied, 1 },	// CB
+	{ "cpy", absolute, 3 },	// CC
+	{ "cmp", absolute, 3 },	// CD
+	{ "dec", absolute, 3 },	// CE
+	{ "???", implied, 1 },	// CF
+	{ "bne", relative, 2 },	// D0
+	{ "cmp", indirectY, 2 },	// D1
+	{ "???", implied, 1 },	// D2
+	{ "???", implied, 1 },	// D3
+	{ "???", implied, 1 },	// D4
+	{ "cmp", zeroPageX, 2 },	// D5
+	{ "dec", zeroPageX, 2 },	// D6
+	{ "???", implied, 1 },	// D7
+	{ "cld", implied, 1 },	// D8
+	{ "cmp", absoluteY, 3 },	// D9
+	{ "???", implied, 1 },	// DA
+	{ "???", implied, 1 },	// DB
+	{ "???", implied, 1 },	// DC
+	{ "cmp", absoluteX, 3 },	// DD
+	{ "dec", absoluteX, 3 },	// DE
+	{ "???", implied, 1 },	// DF
+	{ "cpx", immediate, 2 },	// E0
+	{ "sbc", indirectX, 2 },	// E1
+	{ "???", implied, 1 },	// E2
+	{ "???", implied, 1 },	// E3
+	{ "cpx", zeroPage, 2 },	// E4
+	{ "sbc", zeroPage, 2 },	// E5
+	{ "inc", zeroPage, 2 },	// E6
+	{ "???", implied, 1 },	// E7
+	{ "inx", implied, 1 },	// E8
+	{ "sbc", immediate, 2 },	// E9
+	{ "nop", implied, 1 },	// EA
+	{ "???", implied, 1 },	// EB
+	{ "cpx", absolute, 3 },	// EC
+	{ "sbc", absolute, 3 },	// ED
+	{ "inc", absolute, 3 },	// EE
+	{ "???", implied, 1 },	// EF
+	{ "beq", relative, 2 },	// F0
+	{ "sbc", indirectY, 2 },	// F1
+	{ "???", implied, 1 },	// F2
+	{ "???", implied, 1 },	// F3
+	{ "???", implied, 1 },	// F4
+	{ "sbc", zeroPageX, 2 },	// F5
+	{ "inc", zeroPageX, 2 },	// F6
+	{ "???", implied, 1 },	// F7
+	{ "sed", implied, 1 },	// F8
+	{ "sbc", absoluteY, 3 },	// F9
+	{ "???", implied, 1 },	// FA
+	{ "???", implied, 1 },	// FB
+	{ "???", implied, 1 },	// FC
+	{ "sbc", absoluteX, 3 },	// FD
+	{ "inc", absoluteX, 3 },	// FE
+	{ "???", implied, 1 },	// FF
+};
+
+static_assert(sizeof(SimOpcode_OperandFormats) / sizeof(SimOpcode_OperandFormats[0]) == indirectY + 1, "one format per mode");
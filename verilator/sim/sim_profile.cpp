@@ -0,0 +1,148 @@
+#include "sim_profile.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "imgui.h"
+
+static const char* stage_names[profile_stageCount + 1] = { "eval", "trace", "video", "bus", "gui", "frame" };
+
+SimProfile::SimProfile() {
+	enabled = false;
+	csv = NULL;
+	csvRows = 0;
+	Reset();
+}
+
+void SimProfile::Reset() {
+	memset(current, 0, sizeof(current));
+	gui = 0;
+	frame = -1;
+	memset(lastUs, 0, sizeof(lastUs));
+	memset(totalUs, 0, sizeof(totalUs));
+	frames = 0;
+	memset(histogram, 0, sizeof(histogram));
+	frameStart = 0;
+	ticksPerUs = 0;
+}
+
+static int Bucket(float us) {
+	int bucket = us < 1.0f ? 0 : (int)log2f(us);
+	return bucket < SimProfile_Buckets ? bucket : SimProfile_Buckets - 1;
+}
+
+// Called by the simulation thread when the emulated frame changes
+void SimProfile::EndFrame(int next) {
+	uint64_t now = Now();
+	std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+	uint64_t guiTicks = gui.exchange(0);
+	if (frameStart != 0) {
+		// Calibrate the tick rate against steady_clock over the frame
+		double us = std::chrono::duration<double, std::micro>(nowTime - frameStartTime).count();
+		uint64_t ticks = now - frameStart;
+		if (us > 0 && ticks > 0) {
+			double rate = ticks / us;
+			ticksPerUs = ticksPerUs > 0 ? ticksPerUs * 0.9 + rate * 0.1 : rate;
+		}
+
+		// Frames before the first calibration can't be converted and are dropped
+		if (ticksPerUs > 0) {
+			if (csv) { fprintf(csv, "%d", frame); }
+			for (int stage = 0; stage <= profile_stageCount; stage++) {
+				float value;
+				if (stage == profile_stageCount) { value = (float)us; }
+				else { value = (float)((stage == profile_gui ? guiTicks : current[stage]) / ticksPerUs); }
+				lastUs[stage] = value;
+				totalUs[stage] += value;
+				histogram[stage][Bucket(value)]++;
+				if (csv) { fprintf(csv, ",%.2f", value); }
+			}
+			if (csv) {
+				fprintf(csv, "\n");
+				csvRows++;
+			}
+			frames++;
+		}
+	}
+	memset(current, 0, sizeof(current));
+	frame = next;
+	frameStart = now;
+	frameStartTime = nowTime;
+}
+
+void SimProfile::Draw(const char* title, bool* open) {
+	ImGui::SetNextWindowSize(ImVec2(560, 300), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin(title, open)) {
+		ImGui::End();
+		return;
+	}
+	bool wasEnabled = enabled;
+	ImGui::Checkbox("Enabled", &enabled);
+	if (enabled != wasEnabled) { frameStart = 0; }
+	ImGui::SameLine();
+	if (ImGui::Button("Reset")) { Reset(); }
+	ImGui::SameLine();
+	ImGui::Text("%ld frames", frames);
+
+	// Harness time outside the timed stages, the GUI runs on its own thread so isn't part of it
+	float timed = 0;
+	for (int stage = 0; stage < profile_stageCount; stage++) {
+		if (stage != profile_gui) { timed += lastUs[stage]; }
+	}
+	float frameUs = lastUs[profile_stageCount];
+
+	if (ImGui::BeginTable("profile", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("Stage");
+		ImGui::TableSetupColumn("Last ms");
+		ImGui::TableSetupColumn("Mean ms");
+		ImGui::TableSetupColumn("Share");
+		ImGui::TableSetupColumn("Histogram (log2 us)", ImGuiTableColumnFlags_WidthStretch);
+		ImGui::TableHeadersRow();
+		for (int stage = 0; stage <= profile_stageCount; stage++) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(stage_names[stage]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", lastUs[stage] / 1000.0f);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", frames > 0 ? totalUs[stage] / frames / 1000.0 : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f%%", frameUs > 0 ? lastUs[stage] * 100.0f / frameUs : 0.0f);
+			ImGui::TableNextColumn();
+			float counts[SimProfile_Buckets];
+			for (int i = 0; i < SimProfile_Buckets; i++) { counts[i] = (float)histogram[stage][i]; }
+			ImGui::PushID(stage);
+			ImGui::PlotHistogram("", counts, SimProfile_Buckets, 0, NULL, 0.0f, FLT_MAX, ImVec2(-1, 18));
+			ImGui::PopID();
+		}
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::TextUnformatted("other");
+		ImGui::TableNextColumn();
+		ImGui::Text("%.3f", (frameUs - timed) / 1000.0f);
+		ImGui::TableNextColumn();
+		ImGui::TableNextColumn();
+		ImGui::Text("%.1f%%", frameUs > 0 ? (frameUs - timed) * 100.0f / frameUs : 0.0f);
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
+// One row per profiled frame, times in microseconds
+// Rows are written as each frame ends, so memory stays flat however long the run is
+bool SimProfile::StartCsv(const std::string& file) {
+	csv = fopen(file.c_str(), "w");
+	if (!csv) { return false; }
+	csvRows = 0;
+	fprintf(csv, "frame");
+	for (int stage = 0; stage < profile_stageCount; stage++) { fprintf(csv, ",%s_us", stage_names[stage]); }
+	fprintf(csv, ",frame_us\n");
+	return true;
+}
+
+// Called once the simulation thread has stopped
+void SimProfile::StopCsv() {
+	if (!csv) { return; }
+	fclose(csv);
+	csv = NULL;
+}
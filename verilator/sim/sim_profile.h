@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SIM_PROFILE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SIM_PROFILE_TSC
+#endif
+
+// Stages of the simulation loop that are timed separately
+enum SimProfile_Stage {
+	profile_eval,		// top->eval()
+	profile_trace,		// 6502 instruction logging in verilate()
+	profile_video,		// SimVideo::Clock()
+	profile_bus,		// SimBus::BeforeEval() / AfterEval()
+	profile_gui,		// ImGui frame, texture upload and present (GUI thread)
+	profile_stageCount
+};
+
+const int SimProfile_Buckets = 24;		// Histogram buckets, bucket n counts frames taking [2^n, 2^(n+1)) us
+
+// Time spent in each stage per emulated frame. Scoped timers read the TSC
+// (steady_clock where there is no TSC), which is converted to microseconds at
+// the end of each frame against steady_clock. Only built with SIM_PROFILE, the
+// macros below compile to nothing otherwise so the benchmark build is unaffected.
+struct SimProfile {
+public:
+	bool enabled;
+	uint64_t current[profile_stageCount];	// Ticks so far this frame, owned by the simulation thread
+	std::atomic<uint64_t> gui;				// Ticks so far this frame for the GUI thread
+	int frame;								// Emulated frame being timed
+
+	// Per stage over all frames
+	float lastUs[profile_stageCount + 1];	// Last frame, plus the whole frame in [profile_stageCount]
+	double totalUs[profile_stageCount + 1];
+	long frames;
+	long csvRows;							// Rows written since StartCsv()
+	uint32_t histogram[profile_stageCount + 1][SimProfile_Buckets];
+
+	static inline uint64_t Now() {
+#ifdef SIM_PROFILE_TSC
+		return __rdtsc();
+#else
+		return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	void EndFrame(int next);
+	void Reset();
+	void Draw(const char* title, bool* open);
+	bool StartCsv(const std::string& file);
+	void StopCsv();
+
+	SimProfile();
+
+private:
+	uint64_t frameStart;
+	std::chrono::steady_clock::time_point frameStartTime;
+	double ticksPerUs;
+	FILE* csv;								// Per frame stage times are written here as each frame ends
+};
+
+struct SimProfile_Scope {
+	SimProfile& profile;
+	int stage;
+	uint64_t start;
+
+	SimProfile_Scope(SimProfile& profile, int stage) : profile(profile), stage(stage) {
+		start = profile.enabled ? SimProfile::Now() : 0;
+	}
+	~SimProfile_Scope() {
+		if (start == 0) { return; }
+		uint64_t ticks = SimProfile::Now() - start;
+		if (stage == profile_gui) { profile.gui += ticks; }
+		else { profile.current[stage] += ticks; }
+	}
+};
+
+#ifdef SIM_PROFILE
+#define SIM_PROFILE_SCOPE(profile, stage) SimProfile_Scope profile_scope_##stage(profile, stage)
+#define SIM_PROFILE_FRAME(profile, number) if ((profile).enabled && (number) != (profile).frame) { (profile).EndFrame(number); }
+#else
+#define SIM_PROFILE_SCOPE(profile, stage)
+#define SIM_PROFILE_FRAME(profile, number)
+#endif
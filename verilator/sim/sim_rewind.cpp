@@ -0,0 +1,193 @@
+#include "sim_rewind.h"
+#include <string.h>
+
+// Memory streams
+// --------------
+
+SimMemorySave::SimMemorySave() {
+	m_isOpen = true;
+}
+
+void SimMemorySave::flush() {
+	data.insert(data.end(), m_bufp, m_cp);
+	m_cp = m_bufp;
+}
+
+SimMemoryRestore::SimMemoryRestore(const std::vector<vluint8_t>& source) : source(source) {
+	position = 0;
+	m_isOpen = true;
+	m_endp = m_bufp;
+}
+
+void SimMemoryRestore::fill() {
+	// Move unread bytes to the start of the buffer then top it up from the source
+	vluint8_t* rp = m_bufp;
+	for (vluint8_t* sp = m_cp; sp < m_endp; *rp++ = *sp++) {}
+	m_endp = m_bufp + (m_endp - m_cp);
+	m_cp = m_bufp;
+	size_t space = bufferSize() - (m_endp - m_bufp);
+	size_t count = source.size() - position;
+	if (count > space) { count = space; }
+	memcpy(m_endp, source.data() + position, count);
+	position += count;
+	m_endp += count;
+	// Pad with zeros at the end of the source, as VerilatedRestore does at EOF
+	while (m_endp < m_bufp + bufferSize()) { *m_endp++ = 0; }
+}
+
+// Delta encoding
+// --------------
+// A delta is the XOR of two snapshots stored as (zero run, literal length, literal bytes)
+// records with LEB128 lengths. Adjacent frames mostly differ in a few RAM bytes and
+// the frame buffer, so long zero runs dominate.
+
+static void PutLength(std::vector<vluint8_t>& out, size_t value) {
+	while (value >= 0x80) {
+		out.push_back((vluint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((vluint8_t)value);
+}
+
+static size_t GetLength(const vluint8_t*& p) {
+	size_t value = 0;
+	int shift = 0;
+	while (*p & 0x80) {
+		value |= (size_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	value |= (size_t)(*p++) << shift;
+	return value;
+}
+
+// Encode raw against base (NULL = zeros)
+static void EncodeDelta(const vluint8_t* base, const std::vector<vluint8_t>& raw, std::vector<vluint8_t>& out) {
+	const size_t minZeroRun = 4;
+	size_t size = raw.size();
+	size_t i = 0;
+	out.clear();
+	while (i < size) {
+		size_t zeroStart = i;
+		while (i < size && raw[i] == (base ? base[i] : 0)) { i++; }
+		size_t literalStart = i;
+		// Extend the literal until a worthwhile zero run starts
+		size_t zeros = 0;
+		while (i < size && zeros < minZeroRun) {
+			zeros = (raw[i] == (base ? base[i] : 0)) ? zeros + 1 : 0;
+			i++;
+		}
+		if (zeros == minZeroRun) { i -= zeros; }
+		PutLength(out, literalStart - zeroStart);
+		PutLength(out, i - literalStart);
+		for (size_t b = literalStart; b < i; b++) { out.push_back(raw[b] ^ (base ? base[b] : 0)); }
+	}
+}
+
+// Apply delta in place to raw, which holds the base snapshot (or zeros)
+static void ApplyDelta(const std::vector<vluint8_t>& delta, std::vector<vluint8_t>& raw) {
+	const vluint8_t* p = delta.data();
+	const vluint8_t* end = p + delta.size();
+	size_t position = 0;
+	while (p < end) {
+		position += GetLength(p);
+		size_t literal = GetLength(p);
+		for (size_t b = 0; b < literal; b++) { raw[position++] ^= *p++; }
+	}
+}
+
+// Snapshot ring
+// -------------
+
+SimRewind::SimRewind(size_t budget, int interval, int keyframeInterval) {
+	this->budget = budget;
+	this->interval = interval;
+	this->keyframeInterval = keyframeInterval;
+	deltaBytes = 0;
+	sinceKeyframe = 0;
+	lastFrame = -1;
+}
+
+SimRewind::~SimRewind() {
+}
+
+int SimRewind::Count() {
+	return (int)snapshots.size();
+}
+
+size_t SimRewind::MemoryUsed() {
+	return deltaBytes + last.size();
+}
+
+int SimRewind::OldestFrame() {
+	return snapshots.empty() ? -1 : snapshots.front().frame;
+}
+
+bool SimRewind::Due(int frame) {
+	return budget > 0 && frame != lastFrame && (lastFrame < 0 || frame - lastFrame >= interval || frame < lastFrame);
+}
+
+void SimRewind::Capture(int frame, const std::vector<vluint8_t>& raw) {
+	SimRewind_Snapshot snapshot;
+	snapshot.frame = frame;
+	snapshot.rawSize = raw.size();
+	snapshot.keyframe = snapshots.empty() || sinceKeyframe >= keyframeInterval || raw.size() != last.size();
+	EncodeDelta(snapshot.keyframe ? NULL : last.data(), raw, snapshot.delta);
+	snapshot.delta.shrink_to_fit();
+
+	sinceKeyframe = snapshot.keyframe ? 1 : sinceKeyframe + 1;
+	deltaBytes += snapshot.delta.size();
+	snapshots.push_back(std::move(snapshot));
+	last = raw;
+	lastFrame = frame;
+	Evict();
+}
+
+void SimRewind::Evict() {
+	// Drop whole keyframe groups from the front, always keeping the newest group
+	while (MemoryUsed() > budget && snapshots.size() > 1) {
+		size_t next = 1;
+		while (next < snapshots.size() && !snapshots[next].keyframe) { next++; }
+		if (next == snapshots.size()) { break; }
+		for (size_t i = 0; i < next; i++) {
+			deltaBytes -= snapshots.front().delta.size();
+			snapshots.pop_front();
+		}
+	}
+}
+
+void SimRewind::Decode(size_t target, std::vector<vluint8_t>& raw) {
+	// Walk forward from the nearest keyframe
+	size_t key = target;
+	while (!snapshots[key].keyframe) { key--; }
+	raw.assign(snapshots[key].rawSize, 0);
+	for (size_t i = key; i <= target; i++) { ApplyDelta(snapshots[i].delta, raw); }
+}
+
+bool SimRewind::Rewind(int count, std::vector<vluint8_t>& raw, int& frame) {
+	if (count < 0 || count >= (int)snapshots.size()) { return false; }
+	size_t index = snapshots.size() - 1 - count;
+	Decode(index, raw);
+	frame = snapshots[index].frame;
+
+	// History after the restored point is discarded, and it becomes the delta base again
+	while (snapshots.size() > index + 1) {
+		deltaBytes -= snapshots.back().delta.size();
+		snapshots.pop_back();
+	}
+	sinceKeyframe = 0;
+	for (size_t i = index + 1; i-- > 0;) {
+		sinceKeyframe++;
+		if (snapshots[i].keyframe) { break; }
+	}
+	last = raw;
+	lastFrame = frame;
+	return true;
+}
+
+void SimRewind::Clear() {
+	snapshots.clear();
+	last.clear();
+	deltaBytes = 0;
+	sinceKeyframe = 0;
+	lastFrame = -1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include "verilated_save.h"
+
+// Serialises into a memory buffer instead of a file
+class SimMemorySave final : public VerilatedSerialize {
+public:
+	std::vector<vluint8_t> data;
+
+	SimMemorySave();
+	virtual void flush() override;
+};
+
+// Deserialises from a memory buffer instead of a file
+class SimMemoryRestore final : public VerilatedDeserialize {
+public:
+	SimMemoryRestore(const std::vector<vluint8_t>& source);
+	virtual void fill() override;
+
+private:
+	const std::vector<vluint8_t>& source;
+	size_t position;
+};
+
+struct SimRewind_Snapshot {
+	int frame;
+	bool keyframe;			// Delta against zeros rather than the previous snapshot
+	size_t rawSize;
+	std::vector<vluint8_t> delta;
+};
+
+struct SimRewind {
+public:
+	size_t budget;			// Memory budget in bytes for all stored snapshots
+	int interval;			// Frames between snapshots
+	int keyframeInterval;	// Snapshots between keyframes (bounds the cost of a rewind)
+
+	int Count();
+	size_t MemoryUsed();
+	int OldestFrame();
+	bool Due(int frame);
+	void Capture(int frame, const std::vector<vluint8_t>& raw);
+	bool Rewind(int snapshots, std::vector<vluint8_t>& raw, int& frame);
+	void Clear();
+
+	SimRewind(size_t budget, int interval, int keyframeInterval);
+	~SimRewind();
+
+private:
+	std::deque<SimRewind_Snapshot> snapshots;
+	std::vector<vluint8_t> last;	// Raw copy of the newest snapshot, base for the next delta
+	size_t deltaBytes;
+	int sinceKeyframe;
+	int lastFrame;
+
+	void Decode(size_t index, std::vector<vluint8_t>& raw);
+	void Evict();
+};
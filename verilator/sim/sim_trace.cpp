@@ -0,0 +1,223 @@
+#include "sim_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool HasSuffix(const char* value, size_t length, const char* suffix) {
+	size_t suffixLength = strlen(suffix);
+	return length >= suffixLength && memcmp(value + length - suffixLength, suffix, suffixLength) == 0;
+}
+
+static int FormatRecord(const SimTrace_Record& record, char* line, size_t size) {
+	int length = snprintf(line, size, "%04X: %.3s", record.pc, record.mnemonic);
+	return length + snprintf(line + length, size - length, SimOpcode_OperandFormats[record.form], record.operand);
+}
+
+SimTrace::SimTrace() {
+	windowSize = 65536;
+	checkpointInterval = 4096;
+	data = NULL;
+	size = 0;
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	fileHandle = -1;
+#endif
+	windowStart = 0;
+	windowEnd = 0;
+}
+
+SimTrace::~SimTrace() {
+	Close();
+}
+
+bool SimTrace::Open(std::string file) {
+	Close();
+#ifdef _WIN32
+	fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) { return false; }
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	size = fileSize.QuadPart;
+	if (size > 0) {
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mappingHandle ? (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!data) { Close(); return false; }
+	}
+#else
+	fileHandle = open(file.c_str(), O_RDONLY);
+	if (fileHandle < 0) { return false; }
+	struct stat st;
+	fstat(fileHandle, &st);
+	size = st.st_size;
+	if (size > 0) {
+		void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileHandle, 0);
+		if (map == MAP_FAILED) { Close(); return false; }
+		madvise(map, size, MADV_SEQUENTIAL);
+		data = (const char*)map;
+	}
+#endif
+	return true;
+}
+
+void SimTrace::Close() {
+#ifdef _WIN32
+	if (data) { UnmapViewOfFile(data); }
+	if (mappingHandle) { CloseHandle(mappingHandle); }
+	if (fileHandle != INVALID_HANDLE_VALUE) { CloseHandle(fileHandle); }
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	if (data) { munmap((void*)data, size); }
+	if (fileHandle >= 0) { close(fileHandle); }
+	fileHandle = -1;
+#endif
+	data = NULL;
+	size = 0;
+	window.clear();
+	windowStart = 0;
+	windowEnd = 0;
+	checkpoints.clear();
+}
+
+bool SimTrace::IsOpen() {
+#ifdef _WIN32
+	return fileHandle != INVALID_HANDLE_VALUE;
+#else
+	return fileHandle >= 0;
+#endif
+}
+
+// Finds the line starting at offset and moves offset to the next one
+bool SimTrace::ReadLine(uint64_t& offset, size_t lineIndex, uint64_t& start, uint32_t& length) {
+	if (offset >= size) { return false; }
+	if (lineIndex % checkpointInterval == 0 && lineIndex / checkpointInterval == checkpoints.size()) {
+		checkpoints.push_back(offset);
+	}
+	start = offset;
+	const char* newline = (const char*)memchr(data + offset, '\n', size - offset);
+	uint64_t end = newline ? newline - data : size;
+	offset = newline ? end + 1 : size;
+	if (end > start && data[end - 1] == '\r') { end--; }
+	length = (uint32_t)(end - start);
+	return true;
+}
+
+// Restarts the window at index from the nearest known checkpoint
+bool SimTrace::Seek(size_t index) {
+	size_t line = 0;
+	uint64_t offset = 0;
+	if (!checkpoints.empty()) {
+		size_t checkpoint = index / checkpointInterval;
+		if (checkpoint >= checkpoints.size()) { checkpoint = checkpoints.size() - 1; }
+		line = checkpoint * checkpointInterval;
+		offset = checkpoints[checkpoint];
+	}
+	window.clear();
+	uint64_t start;
+	uint32_t length;
+	while (line < index) {
+		if (!ReadLine(offset, line, start, length)) { break; }
+		line++;
+	}
+	windowStart = line;
+	windowEnd = offset;
+	return line == index;
+}
+
+bool SimTrace::Get(size_t index, SimTrace_Record& record) {
+	if (!data) { return false; }
+	// Jumps backwards or far ahead go through the checkpoints, otherwise parse forward
+	if (index < windowStart || index > windowStart + window.size() + windowSize) {
+		if (!Seek(index)) { return false; }
+	}
+	while (index >= windowStart + window.size()) {
+		SimTrace_Line line;
+		if (!ReadLine(windowEnd, windowStart + window.size(), line.offset, line.length)) { return false; }
+		if (!Parse(data + line.offset, line.length, line.record)) {
+			memset(&line.record, 0, sizeof(line.record));
+			line.record.form = SimTrace_Text;
+		}
+		window.push_back(line);
+		if (window.size() > windowSize) {
+			window.pop_front();
+			windowStart++;
+		}
+	}
+	record = window[index - windowStart].record;
+	return true;
+}
+
+std::string SimTrace::Line(size_t index) {
+	SimTrace_Record record;
+	if (!Get(index, record)) { return ""; }
+	const SimTrace_Line& line = window[index - windowStart];
+	return std::string(data + line.offset, line.length);
+}
+
+// Builds the record for an instruction, false if its text has no record form
+bool SimTrace::Make(int pc, const char* mnemonic, instruction_type type, int operand, SimTrace_Record& record) {
+	if (strlen(mnemonic) != 3 || pc < 0 || pc > 0xFFFF) { return false; }
+	if (type == relative) { type = absolute; }
+	int limit = (type == absolute || type == absoluteX || type == absoluteY || type == indirect) ? 0xFFFF : 0xFF;
+	if (operand < 0 || operand > limit) { return false; }
+	record.pc = (uint16_t)pc;
+	record.form = (uint8_t)type;
+	memcpy(record.mnemonic, mnemonic, 3);
+	record.operand = (type == implied || type == accumulator) ? 0 : (uint32_t)operand;
+	return true;
+}
+
+std::string SimTrace::Format(const SimTrace_Record& record) {
+	char line[64];
+	FormatRecord(record, line, sizeof(line));
+	return line;
+}
+
+// Only accepts lines that format back to exactly the same text, so comparing
+// records gives the same answer as comparing lines
+bool SimTrace::Parse(const char* text, uint32_t length, SimTrace_Record& record) {
+	char line[64];
+	if (length < 9 || length >= sizeof(line) || text[4] != ':' || text[5] != ' ') { return false; }
+	memcpy(line, text, length);
+	line[length] = 0;
+
+	record.pc = (uint16_t)strtoul(line, NULL, 16);
+	memcpy(record.mnemonic, line + 6, 3);
+	record.operand = 0;
+
+	const char* operand = line + 9;
+	size_t operandLength = length - 9;
+	const char* value = NULL;
+	if (operandLength == 0) { record.form = implied; }
+	else if (strcmp(operand, " a") == 0) { record.form = accumulator; }
+	else if (strncmp(operand, " #$", 3) == 0) { record.form = immediate; value = operand + 3; }
+	else if (strncmp(operand, " ($", 3) == 0) {
+		record.form = HasSuffix(operand, operandLength, "), x") ? indirectX : HasSuffix(operand, operandLength, "), y") ? indirectY : indirect;
+		value = operand + 3;
+	}
+	else if (strncmp(operand, " $", 2) == 0) {
+		size_t digits = strspn(operand + 2, "0123456789abcdef");
+		bool x = HasSuffix(operand, operandLength, ", x");
+		bool y = HasSuffix(operand, operandLength, ", y");
+		if (digits == 4) { record.form = x ? absoluteX : y ? absoluteY : absolute; }
+		else { record.form = x ? zeroPageX : y ? zeroPageY : zeroPage; }
+		value = operand + 2;
+	}
+	else { return false; }
+	if (value) { record.operand = (uint32_t)strtoul(value, NULL, 16); }
+
+	char formatted[64];
+	int formattedLength = FormatRecord(record, formatted, sizeof(formatted));
+	return formattedLength == (int)length && memcmp(formatted, line, length) == 0;
+}
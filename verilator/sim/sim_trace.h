@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "sim_opcodes.h"
+
+// Form of a line that could not be represented as a record, compare it as text instead
+const uint8_t SimTrace_Text = 0xFF;
+
+// One traced instruction, in the same text format as the MAME trace ("F5A6: lda #$00")
+struct SimTrace_Record {
+	uint16_t pc;
+	uint8_t form;		// instruction_type (relative is stored as absolute, they print the same)
+	char mnemonic[3];
+	uint32_t operand;
+
+	bool operator==(const SimTrace_Record& other) const {
+		return pc == other.pc && form == other.form && operand == other.operand &&
+			mnemonic[0] == other.mnemonic[0] && mnemonic[1] == other.mnemonic[1] && mnemonic[2] == other.mnemonic[2];
+	}
+	bool operator!=(const SimTrace_Record& other) const { return !(*this == other); }
+};
+
+struct SimTrace_Line {
+	uint64_t offset;	// Position of the line text in the mapped file
+	uint32_t length;
+	SimTrace_Record record;
+};
+
+// MAME trace read from a memory mapped file. Lines are parsed as they are
+// reached and only a window of them is kept, plus the file offset of every
+// checkpointInterval'th line so earlier lines (after a rewind or state load)
+// can be found again without rescanning the whole file.
+struct SimTrace {
+public:
+	size_t windowSize;			// Parsed lines kept in memory
+	size_t checkpointInterval;	// Lines between stored offsets
+
+	bool Open(std::string file);
+	void Close();
+	bool IsOpen();
+	bool Get(size_t index, SimTrace_Record& record);
+	std::string Line(size_t index);
+	bool Make(int pc, const char* mnemonic, instruction_type type, int operand, SimTrace_Record& record);
+	std::string Format(const SimTrace_Record& record);
+
+	SimTrace();
+	~SimTrace();
+
+private:
+	const char* data;
+	uint64_t size;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fileHandle;
+#endif
+
+	std::deque<SimTrace_Line> window;
+	size_t windowStart;			// Line index of window.front()
+	uint64_t windowEnd;			// File offset after window.back()
+	std::vector<uint64_t> checkpoints;
+
+	bool Seek(size_t index);
+	bool ReadLine(uint64_t& offset, size_t lineIndex, uint64_t& start, uint32_t& length);
+	bool Parse(const char* line, uint32_t length, SimTrace_Record& record);
+};
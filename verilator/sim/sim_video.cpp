@@ -2,8 +2,13 @@
 #include "sim_video.h"
 
 #include <string>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
 
-#ifndef _MSC_VER
+#if defined(SIM_HEADLESS)
+#include <sys/time.h>
+#elif !defined(_MSC_VER)
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl2.h"
 #include <stdio.h>
@@ -26,8 +31,9 @@ int output_height = 512;
 int output_rotate = 0;
 bool output_vflip = false;
 
-uint32_t* output_ptr = NULL;
-unsigned int output_size;
+// frame_ready holds a buffer index plus frame_fresh when it has not been picked up yet
+const int frame_fresh = 4;
+#ifndef SIM_HEADLESS
 #ifdef WIN32
 HWND hwnd;
 WNDCLASSEX wc;
@@ -40,12 +46,11 @@ ImTextureID texture_id;
 ImGuiIO io;
 
 ImVec4 clear_color = ImVec4(0.25f, 0.35f, 0.40f, 0.80f);
+#endif
 
 int count_pixel;
 int count_line;
 int count_frame;
-bool last_hblank;
-bool last_vblank;
 
 // Statistics
 #ifdef WIN32
@@ -65,7 +70,8 @@ int stats_xMin;
 int stats_yMin;
 
 
-#ifndef WIN32
+#if defined(SIM_HEADLESS)
+#elif !defined(WIN32)
 SDL_Renderer* renderer = NULL;
 SDL_Texture* texture = NULL;
 #else
@@ -90,7 +96,7 @@ static int                      g_VertexBufferSize = 5000, g_IndexBufferSize = 1
 static ID3D11Texture2D* texture = NULL;
 #endif
 
-#ifdef WIN32
+#if defined(WIN32) && !defined(SIM_HEADLESS)
 // Data
 static IDXGISwapChain* g_pSwapChain = NULL;
 static ID3D11RenderTargetView* g_mainRenderTargetView = NULL;
@@ -194,18 +200,43 @@ SimVideo::SimVideo(int width, int height, int rotate)
 	stats_yMax = -100;
 	stats_xMin = 1000;
 	stats_yMin = 1000;
+
+	// Setup pointers for video texture
+	for (int i = 0; i < SimVideo_FrameCount; i++) {
+		frame_buffers[i] = (uint32_t*)malloc(output_size);
+		memset(frame_buffers[i], 0xAA, output_size);
+	}
+	frame_back = 0;
+	frame_ready = 1;
+	frame_front = 2;
+	output_ptr = frame_buffers[frame_back];
+
+	line_capacity = 1024;
+	line_buffer = (uint32_t*)malloc(line_capacity * sizeof(uint32_t));
+	line_start = 0;
+	line_length = 0;
+
+	table_size = (output_width > output_height ? output_width : output_height) + 2;
+	pixel_offset = (int*)malloc(table_size * sizeof(int));
+	line_offset = (int*)malloc(table_size * sizeof(int));
+	BuildTables();
 }
 
 SimVideo::~SimVideo()
 {
-
+	for (int i = 0; i < SimVideo_FrameCount; i++) {
+		free(frame_buffers[i]);
+		frame_buffers[i] = NULL;
+	}
+	output_ptr = NULL;
+	free(line_buffer);
+	free(pixel_offset);
+	free(line_offset);
 }
 
+#ifndef SIM_HEADLESS
 int SimVideo::Initialise(const char* windowTitle) {
 
-	// Setup pointers for video texture
-	output_ptr = (uint32_t*)malloc(output_size);
-
 #ifdef WIN32
 	// Create application window
 	wc = { sizeof(WNDCLASSEX), CS_CLASSDC, WndProc, 0L, 0L, GetModuleHandle(NULL), NULL, NULL, NULL, NULL, _T(windowTitle), NULL };
@@ -265,8 +296,6 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 #endif
 
-	memset(output_ptr, 0xAA, output_size);
-
 
 #ifdef WIN32
 	// Upload texture to graphics system
@@ -284,7 +313,7 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 
 	D3D11_SUBRESOURCE_DATA subResource;
-	subResource.pSysMem = output_ptr;
+	subResource.pSysMem = frame_buffers[frame_front];
 	subResource.SysMemPitch = desc.Width * 4;
 	subResource.SysMemSlicePitch = 0;
 	g_pd3dDevice->CreateTexture2D(&desc, &subResource, &texture);
@@ -323,7 +352,7 @@ int SimVideo::Initialise(const char* windowTitle) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, output_ptr);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, frame_buffers[frame_front]);
 	texture_id = (ImTextureID)tex;
 #endif
 	return 0;
@@ -331,12 +360,15 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 void SimVideo::UpdateTexture() {
 
+	// Only upload when the simulation has completed a frame since the last one
+	bool fresh = AcquireFrame();
+
 #ifdef WIN32
 	// Update the texture!
 	// D3D11_USAGE_DEFAULT MUST be set in the texture description (somewhere above) for this to work.
 	// (D3D11_USAGE_DYNAMIC is for use with map / unmap.) ElectronAsh.
 
-	g_pd3dDeviceContext->UpdateSubresource(texture, 0, NULL, output_ptr, output_width * 4, 0);
+	if (fresh) { g_pd3dDeviceContext->UpdateSubresource(texture, 0, NULL, frame_buffers[frame_front], output_width * 4, 0); }
 
 	// Rendering
 	ImGui::Render();
@@ -346,7 +378,10 @@ void SimVideo::UpdateTexture() {
 	g_pSwapChain->Present(1, 0); // Present without vsync
 #else
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, output_ptr);
+	if (fresh) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, output_width, output_height, GL_RGBA, GL_UNSIGNED_BYTE, frame_buffers[frame_front]);
+	}
 
 	// Rendering
 	ImGui::Render();
@@ -385,6 +420,13 @@ void SimVideo::CleanUp() {
 }
 
 
+// Swap the newest completed frame in as the front buffer, false if there isn't a new one
+bool SimVideo::AcquireFrame() {
+	if (!(frame_ready.load(std::memory_order_acquire) & frame_fresh)) { return false; }
+	frame_front = frame_ready.exchange(frame_front, std::memory_order_acq_rel) & ~frame_fresh;
+	return true;
+}
+
 void SimVideo::StartFrame() {
 #ifdef WIN32
 	ImGui_ImplDX11_NewFrame();
@@ -394,66 +436,100 @@ void SimVideo::StartFrame() {
 	ImGui_ImplSDL2_NewFrame(window);
 #endif
 }
+#endif
 
-void SimVideo::Clock(bool hblank, bool vblank, uint32_t colour) {
-
-	int ox = count_pixel + 1;
-	int oy = count_line;
-
-	// Only draw outside of blanks
-	if (!(hblank || vblank)) {
-
-		int x = ox, xs = output_width, y = oy;
+static int Clamp(int value, int max) {
+	return value < 0 ? 0 : value > max ? max : value;
+}
 
+// Rotation and flip only ever combine the pixel position into one texture axis and the
+// line into the other, so each transform splits into a per-pixel and a per-line offset.
+// Beyond the end of the tables the clamped coordinates no longer change.
+void SimVideo::BuildTables() {
+	table_rotate = output_rotate;
+	table_vflip = output_vflip;
+	for (int i = 0; i < table_size; i++) {
 		if (output_rotate == -1) {
-			// Rotate output by 90 degrees clockwise
-			y = output_height - ox;
-			xs = output_width;
-			x = oy;
+			// Rotate output by 90 degrees anticlockwise
+			int y = output_height - i;
+			pixel_offset[i] = Clamp(output_vflip ? output_height - y : y, output_height - 1) * output_width;
+			line_offset[i] = Clamp(i, output_width - 1);
 		}
-		if (output_rotate == 1) {
+		else if (output_rotate == 1) {
 			// Rotate output by 90 degrees clockwise
-			y = ox;
-			xs = output_width;
-			x = output_width - oy;
+			pixel_offset[i] = Clamp(output_vflip ? output_height - i : i, output_height - 1) * output_width;
+			line_offset[i] = Clamp(output_width - i, output_width - 1);
 		}
-
-		if (output_vflip) {
-			y = output_height - y;
+		else {
+			pixel_offset[i] = Clamp(i, output_width - 1);
+			line_offset[i] = Clamp(output_vflip ? output_height - i : i, output_height - 1) * output_width;
 		}
+	}
+}
 
-		// Clamp values to stop access violations on texture
-		if (x < 0) { x = 0; }
-		if (x > output_width - 1) { x = output_width - 1; }
-		if (y < 0) { y = 0; }
-		if (y > output_height - 1) { y = output_height - 1; }
-
-		// Generate texture address
-		uint32_t vga_addr = (y * xs) + x;
-
-		// Write pixel to texture
-		output_ptr[vga_addr] = colour;
+void SimVideo::FlushLine() {
+	if (line_length == 0) { return; }
+	if (table_rotate != output_rotate || table_vflip != output_vflip) { BuildTables(); }
+
+	int last = table_size - 1;
+	int first = line_start < last ? line_start : last;
+	int end = line_start + line_length - 1 < last ? line_start + line_length - 1 : last;
+	int row = line_offset[count_line < last ? count_line : last];
+	if (output_rotate == 0 && line_start + line_length <= output_width) {
+		// Unrotated and unclamped, the line is one contiguous run of the texture
+		memcpy(output_ptr + row + line_start, line_buffer, line_length * sizeof(uint32_t));
+	}
+	else {
+		for (int i = 0; i < line_length; i++) {
+			int p = line_start + i;
+			output_ptr[row + pixel_offset[p < last ? p : last]] = line_buffer[i];
+		}
+	}
 
-		// Track bounds (debug)
+	// Track bounds (debug), coordinates are monotonic along a line so the ends are enough
+	int addr[2] = { row + pixel_offset[first], row + pixel_offset[end] };
+	for (int i = 0; i < 2; i++) {
+		int x = addr[i] % output_width;
+		int y = addr[i] / output_width;
 		if (x > stats_xMax) { stats_xMax = x; }
 		if (y > stats_yMax) { stats_yMax = y; }
 		if (x < stats_xMin) { stats_xMin = x; }
 		if (y < stats_yMin) { stats_yMin = y; }
-
 	}
+	line_length = 0;
+}
+
+// Pixels that don't continue the buffered run (a gap or a full buffer) start a new one
+void SimVideo::StartRun(int position) {
+	FlushLine();
+	line_start = position;
+}
 
-	// Increment pixel counter
-	count_pixel++;
+// Hand the completed back buffer to the display and carry on drawing over a copy of it,
+// as pixels that are not redrawn keep their previous colour
+void SimVideo::PublishFrame() {
+#ifndef SIM_HEADLESS
+	int completed = frame_back;
+	frame_back = frame_ready.exchange(completed | frame_fresh, std::memory_order_acq_rel) & ~frame_fresh;
+	memcpy(frame_buffers[frame_back], frame_buffers[completed], output_size);
+	output_ptr = frame_buffers[frame_back];
+#endif
+}
 
+void SimVideo::BlankEdge(bool hblank, bool vblank) {
 	// Falling edge of hblank
 	if (last_hblank && !hblank) {
-		// Increment line and reset pixel count
+		// Write out the finished line, then increment line and reset pixel count
+		FlushLine();
 		count_line++;
 		count_pixel = 0;
 	}
 
 	// Falling edge of vblank
 	if (last_vblank && !vblank) {
+		FlushLine();
+		if (frame_done) { frame_done(count_frame, output_ptr); }
+		PublishFrame();
 		count_frame++;
 		count_line = 0;
 
@@ -470,6 +546,24 @@ void SimVideo::Clock(bool hblank, bool vblank, uint32_t colour) {
 		stats_fps = (float)(1000.0 / stats_frameTime);
 
 	}
-	last_hblank = hblank;
-	last_vblank = vblank;
-}
\ No newline at end of file
+}
+
+void SimVideo::Save(VerilatedSerialize& os) {
+	os.write(&count_pixel, sizeof(count_pixel));
+	os.write(&count_line, sizeof(count_line));
+	os.write(&count_frame, sizeof(count_frame));
+	os << last_hblank << last_vblank;
+	FlushLine();
+	// Keep the last frame so the display is correct straight after a restore
+	os.write(output_ptr, output_size);
+}
+
+void SimVideo::Restore(VerilatedDeserialize& os) {
+	os.read(&count_pixel, sizeof(count_pixel));
+	os.read(&count_line, sizeof(count_line));
+	os.read(&count_frame, sizeof(count_frame));
+	os >> last_hblank >> last_vblank;
+	line_length = 0;
+	os.read(output_ptr, output_size);
+	PublishFrame();
+}
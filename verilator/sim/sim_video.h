@@ -1,7 +1,12 @@
 #pragma once
 
 #include <string>
-#ifndef _MSC_VER
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include "verilated_save.h"
+#if defined(SIM_HEADLESS)
+#elif !defined(_MSC_VER)
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl2.h"
 #else
@@ -12,6 +17,8 @@
 #include <tchar.h>
 #endif
 
+const int SimVideo_FrameCount = 3;		// Back buffer, front buffer and the one in between
+
 struct SimVideo {
 public:
 
@@ -31,13 +38,73 @@ public:
 	int stats_yMax;
 	int stats_yMin;
 
-	ImTextureID texture_id;
+	// Called at the falling edge of vblank with the completed frame (output_width x output_height RGBA)
+	std::function<void(int frame, const uint32_t* pixels)> frame_done;
 
 	SimVideo(int width, int height, int rotate);
 	~SimVideo();
+	inline void Clock(bool hblank, bool vblank, uint32_t colour);
+	void Save(VerilatedSerialize& os);
+	void Restore(VerilatedDeserialize& os);
+#ifndef SIM_HEADLESS
+	ImTextureID texture_id;
+
 	void UpdateTexture();
 	void CleanUp();
 	void StartFrame();
-	void Clock(bool hblank, bool vblank, uint32_t colour);
 	int Initialise(const char* windowTitle);
+#endif
+
+private:
+	// Frames are written into the back buffer and handed to the display through
+	// frame_ready on vblank, so the display only ever sees completed frames
+	uint32_t* output_ptr;
+	unsigned int output_size;
+	uint32_t* frame_buffers[SimVideo_FrameCount];
+	int frame_back;
+	int frame_front;
+	std::atomic<int> frame_ready;
+
+	// Visible pixels are collected per line and written to the texture in one go
+	uint32_t* line_buffer;
+	int line_start;			// Pixel position (count_pixel + 1) of line_buffer[0]
+	int line_length;
+	int line_capacity;
+
+	// Texture offset of a pixel is pixel_offset[pixel position] + line_offset[line],
+	// with rotation, flip and clamping already applied
+	int* pixel_offset;
+	int* line_offset;
+	int table_size;
+	int table_rotate;
+	bool table_vflip;
+
+	bool last_hblank;
+	bool last_vblank;
+
+	void BuildTables();
+	void StartRun(int position);
+	void FlushLine();
+	void PublishFrame();
+#ifndef SIM_HEADLESS
+	bool AcquireFrame();
+#endif
+	void BlankEdge(bool hblank, bool vblank);
 };
+
+// Called on every pixel clock edge, so kept inline with only the buffering here
+inline void SimVideo::Clock(bool hblank, bool vblank, uint32_t colour) {
+	// Only draw outside of blanks
+	if (!(hblank || vblank)) {
+		int position = count_pixel + 1;
+		if (position != line_start + line_length || line_length == line_capacity) { StartRun(position); }
+		line_buffer[line_length++] = colour;
+	}
+
+	// Increment pixel counter
+	count_pixel++;
+
+	if ((last_hblank && !hblank) || (last_vblank && !vblank)) { BlankEdge(hblank, vblank); }
+	last_hblank = hblank;
+	last_vblank = vblank;
+}
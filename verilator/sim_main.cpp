@@ -1,15 +1,30 @@
 #include <iostream>
+#include <chrono>
 #include <verilated.h>
+#include <verilated_config.h>
 #include "Vemu.h"
 
+#ifndef SIM_HEADLESS
 #include "imgui.h"
+#endif
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #ifndef _MSC_VER
 #include <stdio.h>
+#include <sys/resource.h>
+#ifndef SIM_HEADLESS
 #include <SDL.h>
 #include <SDL_opengl.h>
+#endif
 #else
 #define WIN32
 #include <dinput.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
 #endif
 
 #define FMT_HEADER_ONLY
@@ -18,32 +33,52 @@
 #include <sim_console.h>
 #include <sim_bus.h>
 #include <sim_video.h>
+#ifndef SIM_HEADLESS
 #include <sim_input.h>
+#endif
 #include <sim_clock.h>
+#include <sim_trace.h>
+#include <sim_capture.h>
+#include <sim_audio.h>
+#include <sim_profile.h>
+#include <sim_movie.h>
+#include <sim_break.h>
+#include <sim_cpuprofile.h>
+#include "inc/miniz.h"
+#ifdef SIM_SAVABLE
+#include "verilated_save.h"
+#include <sim_rewind.h>
+#endif
 
+#ifndef SIM_HEADLESS
 #include "../imgui/imgui_memory_editor.h"
+#endif
 #include <fstream>
 #include "stdio.h"
 
 
 
-// Debug GUI 
+// Debug GUI
 // ---------
 const char* windowTitle = "Verilator Sim: Arcade-MissileCommand";
 bool showDebugWindow = true;
 const char* debugWindowTitle = "Virtual Dev Board v1.0";
 
-DebugConsole console;
-
+#ifndef SIM_HEADLESS
 MemoryEditor memoryEditor_hs;
+#endif
 
-// MiSTer framework emulation
-// ------------
-SimBus bus(console);
+#ifdef SIM_PROFILE
+SimProfile profile;
+bool showProfileWindow = true;
+std::string profile_csv;	// Per frame stage times, written as the frames end
+#endif
 
 // Input handling
 // --------------
+#ifndef SIM_HEADLESS
 SimInput input(12);
+#endif
 const int input_right = 0;
 const int input_left = 1;
 const int input_down = 2;
@@ -61,81 +96,282 @@ const int input_slam = 10;
 #define VGA_WIDTH 258
 #define VGA_HEIGHT 256
 #define VGA_ROTATE 0
-SimVideo video(VGA_WIDTH, VGA_HEIGHT, VGA_ROTATE);
 
 // Simulation control
 // ------------------
-int initialReset = 32;
-int resetHoldTimer;
-bool run_enable = 1;
 int batchSize = 150000;
-bool single_step = 0;
-bool stop_on_log_mismatch = 1;
-bool multi_step = 0;
 int multi_step_amount = 74000;
+#ifndef SIM_HEADLESS
+bool showBreakWindow = true;
+bool showCpuProfileWindow = true;
+#endif
 
-bool debug_6502 = 1;
-bool debug_cpu = 0;
-bool debug_data = 0;
-bool debug_enable = 0;
+#ifndef SIM_HEADLESS
+// The GUI runs the simulation on its own thread, the model and the settings in the
+// instance are only touched by the GUI while it holds sim_mutex (between batches)
+std::mutex sim_mutex;
+std::atomic<bool> sim_quit(false);
+std::atomic<bool> gui_waiting(false);
+#endif
 
-bool self_test = 0;
-int dip_language = 0;
-int dip_coinage = 0;
+// Headless batch mode
+// -------------------
+#ifdef SIM_HEADLESS
+bool headless = 1;
+#else
+bool headless = 0;
+#endif
 
-int mouse_speed = 2;
-int joystick_sensitivity = 0;
-bool pause;
-bool flip;
+// Parallel runs
+// -------------
+// --jobs FILE runs every job in FILE on a pool of threads, each in its own SimInstance.
+// Only sim_headless takes it: the GUI console keeps one shared ring of lines, which job threads would race on.
+std::string jobs_file;
+int jobs_parallel = 0;					// Jobs run at once, 0 = one per core
+std::string jobs_output = "build/regress";	// Each job's log and $OUT folder go in here
+
+// Model threading
+// ---------------
+// Verilator fixes the thread count when the model is verilated (make THREADS=N)
+#ifdef SIM_THREADS
+const int model_threads = SIM_THREADS;
+#else
+const int model_threads = 1;
+#endif
+int requested_threads = 0;
+
+// Edge schedule
+// -------------
+// A model verilated with SIM_SINGLE_EDGE (make SINGLE_EDGE=1) has its falling edge logic
+// folded into the rising edge, so eval() only runs once per system clock
+#ifdef SIM_SINGLE_EDGE
+const int model_edges = 1;
+#else
+const int model_edges = 2;
+#endif
 
-unsigned char mouse_clock = 0;
-unsigned char mouse_buttons = 0;
-signed short mouse_x = 0;
-signed short mouse_y = 0;
+// Command line, +verilator options on it are passed to every instance's context
+int command_argc;
+char** command_argv;
 
+#ifdef SIM_SAVABLE
+const std::string state_magic = "ARCADE-MISSILECOMMAND-SIM-STATE-2";
 
-// Verilog module
-// --------------v
-Vemu* top = NULL;
+// Harness variables that are saved alongside the model
+struct StateEntry { void* ptr; size_t size; };
+#endif
 
-vluint64_t main_time = 0;	// Current simulation time.
-double sc_time_stamp() {	// Called by $time in Verilog.
-	return main_time;
+const int ins_size = 48;
+
+// Instance defaults, also shown by --help
+const char* const default_mra_file = "../releases/Missile Command (rev 3).mra";
+const char* const default_trace_file = "dump/missile1.tr";
+const int default_rewind_budget_mb = 256;
+
+// Simulation instance
+// -------------------
+// Everything one simulation owns: the model in its own VerilatedContext, the MiSTer bus,
+// video, audio, capture, the 6502 trace and the log. The GUI and a headless run have one,
+// --jobs runs one per job. An instance is only used by one thread at a time, and its
+// console lines go to output when that thread has set it with DebugConsole::SetThreadOutput.
+struct SimInstance {
+public:
+	std::string name;			// Job name, empty outside --jobs
+	FILE* out;					// Reports, stdout unless this is a job
+	std::string json;			// Headless run report as one line of JSON
+	std::vector<std::string> summary;	// Report lines after the run (CAPTURE, AUDIO, TRACE...)
+
+	// Verilog module
+	// --------------
+	std::unique_ptr<VerilatedContext> context;
+	Vemu* top = NULL;
+	vluint64_t main_time = 0;	// Current simulation time, also the context's time for $time
+
+	DebugConsole_Output output;	// Where the console lines go when this is a job
+	DebugConsole console;
+	SimLog log_sink;			// Console lines written to a file by a background thread
+
+	// MiSTer framework emulation
+	SimBus bus;
+	SimVideo video;
+
+	int clockSpeed = 10; // This is not used, just a reminder for the dividers below
+	SimClock clk_sys; // 10mhz
+	SimClock clk_pix; // 5mhz
+
+	// Simulation control
+	// ------------------
+	int initialReset = 32;
+	int resetHoldTimer;
+	bool run_enable = 1;
+	bool single_step = 0;
+	bool stop_on_log_mismatch = 1;
+	bool multi_step = 0;
+	SimBreak breaks;			// PC breakpoints and memory watchpoints, checked every CPU cycle
+	SimCpuProfile cpu_profile;	// Where the 6502 code spends its time, counted every CPU cycle while enabled
+	std::string cpu_profile_file;	// Report written on exit
+	std::string symbol_file;
+	std::string prof_threads_file;
+
+	bool debug_6502 = 1;
+	bool debug_cpu = 0;
+	bool debug_data = 0;
+	bool debug_enable = 0;
+
+	bool self_test = 0;
+	int dip_language = 0;
+	int dip_coinage = 0;
+
+	int mouse_speed = 2;
+	int joystick_sensitivity = 0;
+	bool pause_cpu = 0;
+	bool flip = 0;
+
+	unsigned char mouse_clock = 0;
+	unsigned char mouse_buttons = 0;
+	signed short mouse_x = 0;
+	signed short mouse_y = 0;
+
+	// Headless batch mode
+	// -------------------
+	long headless_frames = 0;		// Stop after this many frames (0 = no limit)
+	vluint64_t headless_cycles = 0;	// Stop after this many sim ticks (0 = no limit)
+	bool rom_backdoor = false;	// Write index 0 ROMs straight into the model instead of downloading them
+	std::string mra_file = default_mra_file;
+
+	// Benchmark scenarios
+	// -------------------
+	// Fixed headless runs for comparing builds and RTL changes, run by bench.sh
+	std::string scenario;
+	bool scenario_inputs = false;	// Drive the inputs from the gameplay script
+	SimMovie movie;					// Input movie being recorded or replayed
+	std::string record_inputs_file;
+	std::string replay_inputs_file;
+	bool json_report = false;		// Report a headless run as one line of JSON
+
+	// Frame capture and audio
+	// -----------------------
+	SimCapture capture;
+	SimAudio audio;
+	std::string audio_golden;		// "samples=N crc32=XXXXXXXX" the audio written must match
+	bool bless = false;				// Write the golden manifest and checksum instead of checking them
+	bool golden_skipped = false;	// A golden named on the command line hasn't been blessed yet
+
+	// Save states
+	// -----------
+	// Needs a model verilated with --savable (SIM_SAVABLE)
+	std::string state_file = "missile.state";	// Used by the GUI save/load buttons
+	std::string load_state_file;				// Restore at startup
+	std::string save_state_file;				// Save when a headless run ends
+
+#ifdef SIM_SAVABLE
+	// In-memory snapshots for rewind
+	int rewind_budget_mb = default_rewind_budget_mb;
+	int rewind_frames = 1;
+	SimRewind rewind_ring;
+#endif
+
+	// 6502 instruction trace
+	// ----------------------
+	int cpu_sync;
+	int cpu_sync_last;
+	long cpu_sync_count;
+	int cpu_clock;
+	int cpu_clock_last;
+	int ins_index = 0;
+	int ins_pc[ins_size];
+	int ins_in[ins_size];
+	int ins_ma[ins_size];
+
+	// MAME debug log
+	long log_index;
+	std::string trace_file = default_trace_file;
+	bool trace_compare = false;	// Compare with the MAME trace as binary records instead of text
+	long trace_length = -1;		// Set once the comparison runs off the end of the trace
+	bool trace_hash = false;		// CRC32 of the executed instructions and their ticks, to check model changes are cycle exact
+	uint32_t trace_crc = MZ_CRC32_INIT;
+	long trace_hashed = 0;
+	SimTrace trace_mame;		// Read on demand from a memory mapped file
+	//long log_breakpoint = 1182;
+	long log_breakpoint = 0;
+	long log_debugat = 0;
+	//long log_debugat = 210000;
+
+	// Undocumented opcodes are reported once each rather than stopping the run
+	bool unknown_reported[256];
+
+	int ParseOption(const std::vector<std::string>& args, size_t& i);
+	int CheckOptions();
+	int Start();
+	void Reset();
+	int Verilate();
+	void ApplySettings();
+	int RunHeadless();
+	bool Finish();
+#ifdef SIM_SAVABLE
+	bool SaveState(const std::string& file);
+	bool LoadState(const std::string& file);
+	bool RewindState(int frames);
+#endif
+
+	SimInstance();
+	~SimInstance();
+
+private:
+	bool WriteLog(const char* line);
+	int InstructionOperand(const SimOpcode& opcode);
+	std::string FormatInstruction(const SimOpcode& opcode);
+	void ReportUnknownOpcode(const SimOpcode& opcode);
+	bool CompareTrace(const SimOpcode& opcode);
+	void DumpInstruction();
+	void CheckBreakpoints();
+	void ProfileCpuCycle();
+	void BackdoorRoms();
+	bool ApplyScenario();
+	void ScriptInputs(int frame);
+	void Summary(const std::string& line);
+	bool FinishCapture();
+	void FinishLog();
+	bool FinishAudio();
+	void FinishCpuProfile();
+#ifdef SIM_SAVABLE
+	std::vector<StateEntry> HarnessState();
+	void SerializeState(VerilatedSerialize& os);
+	bool DeserializeState(VerilatedDeserialize& os);
+	void CaptureRewind();
+#endif
+};
+
+SimInstance::SimInstance() : console(), bus(console), video(VGA_WIDTH, VGA_HEIGHT, VGA_ROTATE), clk_sys(1), clk_pix(2)
+#ifdef SIM_SAVABLE
+	, rewind_ring(0, 1, 60)
+#endif
+{
+	out = stdout;
+	output.time = NULL;
+	output.sink = NULL;
+	output.file = NULL;
+	memset(unknown_reported, 0, sizeof(unknown_reported));
 }
 
-int clockSpeed = 10; // This is not used, just a reminder for the dividers below
-SimClock clk_sys(1); // 10mhz
-SimClock clk_pix(2); // 5mhz
+SimInstance::~SimInstance() {
+	if (!top) { return; }
+	top->final();
+	delete top;
+}
 
-void resetSim() {
+void SimInstance::Reset() {
 	main_time = 0;
 	resetHoldTimer = initialReset;
 	clk_sys.Reset();
 	clk_pix.Reset();
+	cpu_profile.ResetStack();
+#ifdef SIM_SAVABLE
+	rewind_ring.Clear();
+#endif
 }
 
-int cpu_sync;
-int cpu_sync_last;
-long cpu_sync_count;
-int cpu_clock;
-int cpu_clock_last;
-const int ins_size = 48;
-int ins_index = 0;
-int ins_pc[ins_size];
-int ins_in[ins_size];
-int ins_ma[ins_size];
-
-
-// MAME debug log
-std::vector<std::string> log_mame;
-std::vector<std::string> log_cpu;
-long log_index;
-//long log_breakpoint = 1182;
-long log_breakpoint = 0;
-long log_debugat = 0;
-//long log_debugat = 210000;
-
-bool writeLog(const char* line)
+bool SimInstance::WriteLog(const char* line)
 {
 
 	if (debug_6502 && debug_enable) {
@@ -144,8 +380,9 @@ bool writeLog(const char* line)
 
 		std::string c_line = std::string(line);
 		std::string c = "CPU > " + c_line;
-		if (log_index < log_mame.size()) {
-			std::string m_line = log_mame.at(log_index);
+		SimTrace_Record mame;
+		if (trace_mame.Get(log_index, mame)) {
+			std::string m_line = trace_mame.Line(log_index);
 			std::string m = "MAME > " + m_line;
 			int hcnt = top->emu__DOT__missile__DOT__sync_circuit__DOT__hcnt;
 			int vcnt = top->emu__DOT__missile__DOT__sync_circuit__DOT__vcnt;
@@ -154,7 +391,7 @@ bool writeLog(const char* line)
 			//console.AddLog(f.c_str());
 
 			if (stop_on_log_mismatch && m_line != c_line) {
-				console.AddLog("DIFF at %d", log_index);
+				console.Log(log_warning, "DIFF at %d", log_index);
 				console.AddLog(m.c_str());
 				console.AddLog(c.c_str());
 				match = false;
@@ -181,236 +418,100 @@ bool writeLog(const char* line)
 	return true;
 }
 
-enum instruction_type {
-	implied,
-	immediate,
-	absolute,
-	absoluteX,
-	absoluteY,
-	zeroPage,
-	zeroPageX,
-	zeroPageY,
-	relative,
-	accumulator,
-	indirect,
-	indirectX,
-	indirectY
-};
-
-void DumpInstruction() {
+// Operand as it is printed: the byte after the opcode, the 16 bit address, or the branch target
+int SimInstance::InstructionOperand(const SimOpcode& opcode) {
+	if (opcode.mode == relative) { return ins_ma[4] + ((signed char)ins_in[2]); }
+	return opcode.length == 3 ? ins_in[4] << 8 | ins_in[2] : ins_in[2];
+}
 
-	if (cpu_sync_count > 1) {
+std::string SimInstance::FormatInstruction(const SimOpcode& opcode) {
+	char line[64];
+	int length = snprintf(line, sizeof(line), "%04X: %s", ins_pc[0], opcode.mnemonic);
+	snprintf(line + length, sizeof(line) - length, SimOpcode_OperandFormats[opcode.mode], InstructionOperand(opcode));
+	if (!opcode.Known()) {
+		return fmt::format("{0}\t\tPC={1:X} IN0={2:X} IN1={3:X} IN2={4:X} IN3={5:X} IN4={6:X} MA0={7:X} MA1={8:X} MA2={9:X} MA3={10:X} MA4={11:X}",
+			line, ins_pc[0], ins_in[0], ins_in[1], ins_in[2], ins_in[3], ins_in[4], ins_ma[0], ins_ma[1], ins_ma[2], ins_ma[3], ins_ma[4]);
+	}
+	return line;
+}
 
-		std::string log = "{0:04X}: ";
-		const char* f = "";
-		const char* sta;
+void SimInstance::ReportUnknownOpcode(const SimOpcode& opcode) {
+	if (unknown_reported[ins_in[0] & 0xFF]) { return; }
+	unknown_reported[ins_in[0] & 0xFF] = true;
+	console.Log(log_warning, "Undocumented opcode %02X at %04X", ins_in[0], ins_pc[0]);
+	console.AddLog(FormatInstruction(opcode).c_str());
+}
 
-		instruction_type type = implied;
+// Binary trace compare: the instruction is compared with the MAME trace as a
+// record, and text is only built when they differ
+bool SimInstance::CompareTrace(const SimOpcode& opcode) {
+	SimTrace_Record cpu;
+	bool known = opcode.Known() && trace_mame.Make(ins_pc[0], opcode.mnemonic, opcode.mode, InstructionOperand(opcode), cpu);
+
+	bool match = true;
+	SimTrace_Record mame;
+	if (trace_mame.Get(log_index, mame)) {
+		if (known && mame.form != SimTrace_Text) { match = cpu == mame; }
+		else { match = FormatInstruction(opcode) == trace_mame.Line(log_index); }
+		if (!match) {
+			console.Log(log_warning, "DIFF at %d", log_index);
+			console.AddLog("MAME > %s", trace_mame.Line(log_index).c_str());
+			console.AddLog("CPU > %s", FormatInstruction(opcode).c_str());
+		}
+	}
+	else if (trace_length < 0) {
+		console.AddLog("End of MAME trace after %d instructions", log_index);
+		trace_length = log_index;
+	}
+	log_index++;
+	return match || !stop_on_log_mismatch;
+}
 
-		int arg1 = 0;
-		int arg2 = 0;
+void SimInstance::DumpInstruction() {
 
-		switch (ins_in[0])
-		{
-		case 0x00: sta = "brk"; break;
-		case 0x98: sta = "tya"; break;
-		case 0xA8: sta = "tay"; break;
-		case 0xAA: sta = "tac"; break;
-		case 0x8A: sta = "txa"; break;
-		case 0x40: sta = "rti"; break;
-		case 0x60: sta = "rts"; break;
-		case 0x9A: sta = "txs"; break;
-		case 0xBA: sta = "tsx"; break;
-
-		case 0x18: sta = "clc"; break;
-		case 0x58: sta = "cli"; break;
-		case 0xB8: sta = "clo"; break;
-		case 0xD8: sta = "cld"; break;
-
-		case 0xE8: sta = "inx"; break;
-		case 0xC8: sta = "iny"; break;
-
-		case 0x80: sta = "nop"; type = immediate; break;
-
-		case 0x38: sta = "sec"; break;
-		case 0x78: sta = "sei"; break;
-		case 0xF8: sta = "sed"; break;
-
-		case 0x48: sta = "pha"; break;
-		case 0x68: sta = "pla"; break;
-
-		case 0x0A: sta = "asl"; type = accumulator; break;
-		case 0x06: sta = "asl"; type = zeroPage; break;
-		case 0x16: sta = "asl"; type = zeroPageX; break;
-		case 0x0E: sta = "asl"; type = absolute; break;
-		case 0x1E: sta = "asl"; type = absoluteX; break;
-
-		case 0x09: sta = "ora"; type = immediate; break;
-		case 0x05: sta = "ora"; type = zeroPage; break;
-		case 0x15: sta = "ora"; type = zeroPageX; break;
-		case 0x0D: sta = "ora"; type = absolute; break;
-		case 0x1D: sta = "ora"; type = absoluteX; break;
-		case 0x19: sta = "ora"; type = absoluteY; break;
-		case 0x01: sta = "ora"; type = indirectX; break;
-		case 0x11: sta = "ora"; type = indirectY; break;
-
-		case 0x49: sta = "eor"; type = immediate; break;
-		case 0x45: sta = "eor"; type = zeroPage; break;
-		case 0x55: sta = "eor"; type = zeroPageX; break;
-		case 0x5d: sta = "eor"; type = absoluteX; break;
-		case 0x59: sta = "eor"; type = absoluteY; break;
-		case 0x41: sta = "eor"; type = indirectX; break;
-		case 0x51: sta = "eor"; type = indirectY; break;
-
-		case 0x29: sta = "and"; type = immediate; break;
-		case 0x25: sta = "and"; type = zeroPage; break;
-		case 0x35: sta = "and"; type = zeroPageX; break;
-		case 0x2D: sta = "and"; type = absolute; break;
-		case 0x3D: sta = "and"; type = absoluteX; break;
-		case 0x39: sta = "and"; type = absoluteY; break;
-
-
-		case 0xE9: sta = "sbc"; type = immediate; break;
-		case 0xE5: sta = "sbc"; type = zeroPage; break;
-		case 0xF5: sta = "sbc"; type = zeroPageX; break;
-		case 0xED: sta = "sbc"; type = absolute; break;
-		case 0xFD: sta = "sbc"; type = absoluteX; break;
-		case 0xF9: sta = "sbc"; type = absoluteY; break;
-		case 0xE1: sta = "sbc"; type = indirectX; break;
-		case 0xF1: sta = "sbc"; type = indirectY; break;
-
-		case 0xC9: sta = "cmp"; type = immediate; break;
-		case 0xC5: sta = "cmp"; type = zeroPageX; break;
-		case 0xDD: sta = "cmp"; type = absoluteX; break;
-
-		case 0xE0: sta = "cpx"; type = immediate; break;
-		case 0xE4: sta = "cpx"; type = zeroPage; break;
-		case 0xEC: sta = "cpx"; type = absolute; break;
-
-		case 0xC0: sta = "cpy"; type = immediate; break;
-		case 0xC4: sta = "cpy"; type = zeroPage; break;
-		case 0xCC: sta = "cpy"; type = absolute; break;
-
-		case 0xA2: sta = "ldx"; type = immediate; break;
-		case 0xA6: sta = "ldx"; type = zeroPage; break;
-		case 0xB6: sta = "ldx"; type = zeroPageY; break;
-		case 0xAE: sta = "ldx"; type = absolute; break;
-		case 0xBE: sta = "ldx"; type = absoluteY; break;
-
-		case 0xA0: sta = "ldy"; type = immediate; break;
-		case 0xA4: sta = "ldy"; type = zeroPage; break;
-		case 0xB4: sta = "ldy"; type = zeroPageX; break;
-		case 0xAC: sta = "ldy"; type = absolute; break;
-		case 0xBC: sta = "ldy"; type = absoluteX; break;
-
-		case 0xA9: sta = "lda"; type = immediate; break;
-		case 0xA5: sta = "lda"; type = zeroPage; break;
-		case 0xB5: sta = "lda"; type = zeroPageX; break;
-		case 0xAD: sta = "lda"; type = absolute; break;
-		case 0xBD: sta = "lda"; type = absoluteX; break;
-		case 0xB9: sta = "lda"; type = absoluteY; break;
-		case 0xA1: sta = "lda"; type = indirectX; break;
-		case 0xB1: sta = "lda"; type = indirectY; break;
-
-
-		case 0x8D: sta = "sta"; type = absolute; break;
-		case 0x85: sta = "sta"; type = zeroPage; break;
-		case 0x95: sta = "sta"; type = zeroPageX; break;
-		case 0x9D: sta = "sta"; type = absoluteX; break;
-		case 0x99: sta = "sta"; type = absoluteY; break;
-		case 0x81: sta = "sta"; type = indirectX; break;
-		case 0x91: sta = "sta"; type = indirectY; break;
-
-		case 0x86: sta = "stx"; type = zeroPage; break;
-		case 0x96: sta = "stx"; type = zeroPageY; break;
-		case 0x8E: sta = "stx"; type = absolute; break;
-		case 0x84: sta = "sty"; type = zeroPage; break;
-		case 0x94: sta = "sty"; type = zeroPageX; break;
-		case 0x8C: sta = "sty"; type = absolute; break;
-
-		case 0x69: sta = "adc"; type = immediate; break;
-		case 0x65: sta = "adc"; type = zeroPage; break;
-		case 0x75: sta = "adc"; type = zeroPageX; break;
-		case 0x6D: sta = "adc"; type = absolute; break;
-		case 0x7D: sta = "adc"; type = absoluteX; break;
-		case 0x79: sta = "adc"; type = absoluteY; break;
-
-		case 0xC6: sta = "dec"; type = zeroPage;  break;
-		case 0xD6: sta = "dec"; type = zeroPageX;  break;
-		case 0xCE: sta = "dec"; type = absolute;  break;
-		case 0xDE: sta = "dec"; type = absoluteX;  break;
-
-		case 0xCA: sta = "dex"; break;
-		case 0x88: sta = "dey"; break;
-
-		case 0x24: sta = "bit"; type = zeroPage; break;
-		case 0x2C: sta = "bit"; type = absolute; break;
-
-		case 0x30: sta = "bmi"; type = relative; break;
-		case 0x90: sta = "bcc"; type = relative; break;
-		case 0xB0: sta = "bcs"; type = relative; break;
-		case 0xD0: sta = "bne"; type = relative; break;
-		case 0xF0: sta = "beq"; type = relative; break;
-		case 0x50: sta = "bvc"; type = relative; break;
-		case 0x10: sta = "bpl"; type = relative; break;
-
-		case 0x2a: sta = "rol"; type = accumulator; break;
-		case 0x7e: sta = "ror"; type = absoluteX; break;
-
-		case 0x4A: sta = "lsr"; type = accumulator; break;
-		case 0x46: sta = "lsr"; type = zeroPage; break;
-
-		case 0xE6: sta = "inc"; type = zeroPage; break;
-		case 0xF6: sta = "inc"; type = zeroPageX; break;
-		case 0xEE: sta = "inc"; type = absolute; break;
-		case 0xFE: sta = "inc"; type = absoluteX; break;
-
-		case 0x20: sta = "jsr"; type = absolute; break;
-
-		case 0x4C: sta = "jmp"; type = absolute; break;
-		case 0x6C: sta = "jmp"; type = indirect; break;
-
-		default: sta = "???"; f = "\t\tPC={0:X} arg1={1:X} arg2={2:X} IN0={3:X} IN1={4:X} IN2={5:X} IN3={6:X} IN4={7:X} MA0={8:X} MA1={9:X} MA2={10:X} MA3={11:X} MA4={12:X}";
-		}
+	if (cpu_sync_count > 1) {
 
-		switch (type) {
-		case implied: f = ""; break;
-		case immediate: arg1 = ins_in[2]; f = " #${1:02x}"; break;
-		case absolute: arg1 = ins_in[4]; arg2 = ins_in[2]; f = " ${1:02x}{2:02x}"; break;
-		case absoluteX: arg1 = ins_in[4]; arg2 = ins_in[2]; f = " ${1:02x}{2:02x}, x"; break;
-		case absoluteY: arg1 = ins_in[4]; arg2 = ins_in[2]; f = " ${1:02x}{2:02x}, y"; break;
-		case zeroPage: arg1 = ins_in[2]; f = " ${1:02x}"; break;
-		case zeroPageX: arg1 = ins_in[2]; f = " ${1:02x}, x"; break;
-		case zeroPageY: arg1 = ins_in[2]; f = " ${1:02x}, y"; break;
-		case relative: arg1 = ins_ma[4] + ((signed char)ins_in[2]); f = " ${1:04x}"; break;
-		case indirect: arg1 = ins_in[2]; f = " (${1:02x})"; break;
-		case indirectX: arg1 = ins_in[2]; f = " (${1:02x}), x"; break;
-		case indirectY: arg1 = ins_in[2]; f = " (${1:02x}), y"; break;
-		case accumulator: f = " a"; break;
+		if (trace_hash) {
+			uint32_t record[3] = { (uint32_t)main_time, (uint32_t)ins_pc[0], (uint32_t)ins_in[0] };
+			trace_crc = (uint32_t)mz_crc32(trace_crc, (const unsigned char*)record, sizeof(record));
+			trace_hashed++;
 		}
 
-		log.append(sta);
-		log.append(f);
+		const SimOpcode& opcode = SimOpcodes[ins_in[0] & 0xFF];
+		if (!opcode.Known()) { ReportUnknownOpcode(opcode); }
 
-		if (sta == "???") {
-			log.append("\t\tPC={0:X} arg1={1:X} arg2={2:X} IN0={3:X} IN1={4:X} IN2={5:X} IN3={6:X} IN4={7:X} MA0={8:X} MA1={9:X} MA2={10:X} MA3={11:X} MA4={12:X}");
+		if (trace_compare) {
+			if (!CompareTrace(opcode)) { run_enable = 0; }
+			return;
 		}
-		log = fmt::format(log, ins_pc[0], arg1, arg2, ins_in[0], ins_in[1], ins_in[2], ins_in[3], ins_in[4], ins_ma[0], ins_ma[1], ins_ma[2], ins_ma[3], ins_ma[4]);
 
-		if (!writeLog(log.c_str())) {
-			run_enable = 0;
-		}
+		std::string log = FormatInstruction(opcode);
 
-		if (sta == "???") {
-			console.AddLog(log.c_str());
+		if (!WriteLog(log.c_str())) {
 			run_enable = 0;
 		}
 	}
 }
 
-int verilate() {
+// Called on the falling edge of phi 0, when the cycle's address, direction and data are all on the bus
+void SimInstance::CheckBreakpoints() {
+	bool read = top->emu__DOT__missile__DOT__mp__DOT__s_READWRITE;
+	uint8_t data = read ? top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__di : top->emu__DOT__missile__DOT__mp__DOT__s_db_out;
+	if (!breaks.Cycle(top->emu__DOT__missile__DOT__mp__DOT__s_addr, read, top->emu__DOT__missile__DOT__mp__DOT__sync, data)) { return; }
+	console.AddLog("BREAK %s: %04X data %02X (frame %d)", breaks.Describe(breaks.hit).c_str(), breaks.hitAddress, breaks.hitData, video.count_frame);
+	run_enable = 0;
+	multi_step = 0;
+}
 
-	if (!Verilated::gotFinish()) {
+void SimInstance::ProfileCpuCycle() {
+	cpu_profile.Cycle(top->emu__DOT__missile__DOT__mp__DOT__s_addr, top->emu__DOT__missile__DOT__mp__DOT__sync,
+		top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__di, top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__any_int, main_time);
+}
+
+// Simulates one tick, 0 once the model has run $finish (the run is stopped)
+int SimInstance::Verilate() {
+
+	if (!context->gotFinish()) {
 
 		// Assert reset during startup
 		if (main_time < initialReset) { top->RESET = 1; }
@@ -424,85 +525,469 @@ int verilate() {
 		// Set system clock in core
 		top->clk_10 = clk_sys.clk;
 
-		// Update console with current cycle for logging
-		console.prefix = "(" + std::to_string(main_time) + ") ";
-
 		// Output pixels on rising edge of pixel clock
 		if (clk_pix.clk && !clk_pix.old) {
+			SIM_PROFILE_SCOPE(profile, profile_video);
 			uint32_t colour = 0xFF000000 | top->VGA_B << 16 | top->VGA_G << 8 | top->VGA_R;
 			video.Clock(top->VGA_HB, top->VGA_VB, colour);
 		}
-
+		SIM_PROFILE_FRAME(profile, video.count_frame);
+
+#ifdef SIM_SINGLE_EDGE
+		// Only the rising edge is simulated. The falling edge is recorded straight into the
+		// model's last clock value, as an eval() would, so the next rising edge is seen.
+		// __Vclklast__ is generated code: make checks the model still detects the clk_10 edge
+		// against it when verilating with SINGLE_EDGE=1, recheck it before widening the versions allowed.
+#if !defined(VERILATOR_VERSION_INTEGER) || VERILATOR_VERSION_INTEGER < 4200000 || VERILATOR_VERSION_INTEGER >= 4300000
+#error "SIM_SINGLE_EDGE writes __Vclklast__TOP__clk_10, which is only checked against Verilator 4.2xx"
+#endif
+		if (!clk_sys.clk && clk_sys.old) { top->__Vclklast__TOP__clk_10 = 0; }
+		bool edge = clk_sys.clk && !clk_sys.old;
+#else
 		// Simulate both edges of system clock
-		if (clk_sys.clk != clk_sys.old) {
-			if (clk_sys.clk) { bus.BeforeEval(); }
-			top->eval();
-
-			bool irq_any = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__any_int;
-
-			//// Log 6502 instructions
-			cpu_clock = top->emu__DOT__missile__DOT__mp__DOT__s_phi_0;
-			bool cpu_reset = top->emu__DOT__missile__DOT__mp__DOT__reset;
-			if (cpu_clock != cpu_clock_last && cpu_reset == 0) {
-
-				if (cpu_sync_count > 0) {
-					ins_pc[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__pc_reg;
-					ins_in[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__di;
-					ins_ma[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__s_addr;
-					ins_index++;
-					if (ins_index > ins_size - 1) { ins_index = 0; }
-				}
-				cpu_sync = top->emu__DOT__missile__DOT__mp__DOT__sync;
-
-				bool cpu_rising = cpu_sync == 1 && cpu_sync_last == 0;
-				// If IRQ hit then ignore this instruction
-				if (cpu_rising && !irq_any) {
-					cpu_sync_count++;
-					if (ins_index > 0) {
-						DumpInstruction();
+		bool edge = clk_sys.clk != clk_sys.old;
+#endif
+		if (edge) {
+			if (clk_sys.clk) {
+				SIM_PROFILE_SCOPE(profile, profile_bus);
+				bus.BeforeEval();
+			}
+			{
+				SIM_PROFILE_SCOPE(profile, profile_eval);
+				top->eval();
+			}
+
+			{
+				SIM_PROFILE_SCOPE(profile, profile_trace);
+				bool irq_any = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__any_int;
+
+				//// Log 6502 instructions
+				cpu_clock = top->emu__DOT__missile__DOT__mp__DOT__s_phi_0;
+				bool cpu_reset = top->emu__DOT__missile__DOT__mp__DOT__reset;
+				if (cpu_clock != cpu_clock_last && cpu_reset == 0) {
+					if (!cpu_clock) {
+						if (breaks.active) { CheckBreakpoints(); }
+						if (cpu_profile.enabled) { ProfileCpuCycle(); }
 					}
 
-					// Clear instruction cache
-					ins_index = 0;
-					for (int i = 0; i < ins_size; i++) {
-						ins_in[i] = 0;
-						ins_ma[i] = 0;
+					if (cpu_sync_count > 0) {
+						ins_pc[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__pc_reg;
+						ins_in[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__di;
+						ins_ma[ins_index] = top->emu__DOT__missile__DOT__mp__DOT__s_addr;
+						ins_index++;
+						if (ins_index > ins_size - 1) { ins_index = 0; }
 					}
+					cpu_sync = top->emu__DOT__missile__DOT__mp__DOT__sync;
+
+					bool cpu_rising = cpu_sync == 1 && cpu_sync_last == 0;
+					// If IRQ hit then ignore this instruction
+					if (cpu_rising && !irq_any) {
+						cpu_sync_count++;
+						if (ins_index > 0) {
+							DumpInstruction();
+						}
+
+						// Clear instruction cache
+						ins_index = 0;
+						for (int i = 0; i < ins_size; i++) {
+							ins_in[i] = 0;
+							ins_ma[i] = 0;
+						}
+					}
+					cpu_sync_last = cpu_sync;
 				}
-				cpu_sync_last = cpu_sync;
+				cpu_clock_last = cpu_clock;
 			}
-			cpu_clock_last = cpu_clock;
-
 
-			if (clk_sys.clk) { bus.AfterEval(); }
+			if (clk_sys.clk) {
+				{
+					SIM_PROFILE_SCOPE(profile, profile_bus);
+					bus.AfterEval();
+				}
+				if (audio.enabled) { audio.Clock(top->AUDIO); }
+			}
 		}
 
 		main_time++;
+		context->time(main_time);
+
+#ifdef SIM_SAVABLE
+		if (rewind_ring.Due(video.count_frame)) { CaptureRewind(); }
+#endif
 		return 1;
 	}
-	// Stop verilating and cleanup
-	top->final();
-	delete top;
-	exit(0);
+	// Stop verilating, the model is cleaned up with the instance
+	run_enable = 0;
+	multi_step = 0;
 	return 0;
 }
 
-int main(int argc, char** argv, char** env) {
+#ifdef SIM_SAVABLE
+std::vector<StateEntry> SimInstance::HarnessState() {
+	return {
+		{ &main_time, sizeof(main_time) },
+		{ &resetHoldTimer, sizeof(resetHoldTimer) },
+		{ &cpu_sync, sizeof(cpu_sync) },
+		{ &cpu_sync_last, sizeof(cpu_sync_last) },
+		{ &cpu_sync_count, sizeof(cpu_sync_count) },
+		{ &cpu_clock, sizeof(cpu_clock) },
+		{ &cpu_clock_last, sizeof(cpu_clock_last) },
+		{ &ins_index, sizeof(ins_index) },
+		{ ins_pc, sizeof(ins_pc) },
+		{ ins_in, sizeof(ins_in) },
+		{ ins_ma, sizeof(ins_ma) },
+		{ &log_index, sizeof(log_index) },
+		{ &debug_enable, sizeof(debug_enable) },
+		{ &self_test, sizeof(self_test) },
+		{ &dip_language, sizeof(dip_language) },
+		{ &dip_coinage, sizeof(dip_coinage) },
+		{ &mouse_speed, sizeof(mouse_speed) },
+		{ &joystick_sensitivity, sizeof(joystick_sensitivity) },
+		{ &pause_cpu, sizeof(pause_cpu) },
+		{ &mouse_x, sizeof(mouse_x) },
+		{ &mouse_y, sizeof(mouse_y) },
+	};
+}
 
-	// Load MAME debug log
-	std::string line;
-	std::ifstream fin("dump/missile1.tr");
-	while (getline(fin, line)) {
-		log_mame.push_back(line);
+void SimInstance::SerializeState(VerilatedSerialize& os) {
+	os << state_magic;
+	for (const StateEntry& entry : HarnessState()) { os.write(entry.ptr, entry.size); }
+	clk_sys.Save(os);
+	clk_pix.Save(os);
+	bus.Save(os);
+	video.Save(os);
+	os << *top;
+}
+
+bool SimInstance::DeserializeState(VerilatedDeserialize& os) {
+	std::string magic;
+	os >> magic;
+	if (magic != state_magic) { return false; }
+	for (const StateEntry& entry : HarnessState()) { os.read(entry.ptr, entry.size); }
+	clk_sys.Restore(os);
+	clk_pix.Restore(os);
+	bus.Restore(os);
+	video.Restore(os);
+	os >> *top;
+	context->time(main_time);
+	cpu_profile.ResetStack();
+	return true;
+}
+
+bool SimInstance::SaveState(const std::string& file) {
+	VerilatedSave os;
+	os.open(file);
+	if (!os.isOpen()) {
+		console.Log(log_error, "Cannot open state file for writing: %s", file.c_str());
+		return false;
+	}
+	SerializeState(os);
+	console.AddLog("Saved state to %s at main_time=%llu frame=%d", file.c_str(), (unsigned long long)main_time, video.count_frame);
+	return true;
+}
+
+bool SimInstance::LoadState(const std::string& file) {
+	VerilatedRestore os;
+	os.open(file);
+	if (!os.isOpen()) {
+		console.Log(log_error, "Cannot open state file for reading: %s", file.c_str());
+		return false;
 	}
+	if (!DeserializeState(os)) {
+		console.Log(log_error, "Not a compatible state file: %s", file.c_str());
+		return false;
+	}
+	// Rewind history belongs to the previous timeline
+	rewind_ring.Clear();
+	console.AddLog("Loaded state from %s at main_time=%llu frame=%d", file.c_str(), (unsigned long long)main_time, video.count_frame);
+	return true;
+}
+
+// Take an in-memory snapshot when a new frame starts
+void SimInstance::CaptureRewind() {
+	SimMemorySave os;
+	SerializeState(os);
+	os.flush();
+	rewind_ring.Capture(video.count_frame, os.data);
+}
+
+bool SimInstance::RewindState(int frames) {
+	std::vector<vluint8_t> raw;
+	int frame;
+	if (!rewind_ring.Rewind(frames / rewind_ring.interval, raw, frame)) {
+		console.Log(log_error, "Cannot rewind %d frames, %d snapshots held", frames, rewind_ring.Count());
+		return false;
+	}
+	SimMemoryRestore os(raw);
+	DeserializeState(os);
+	console.AddLog("Rewound to frame %d at main_time=%llu", frame, (unsigned long long)main_time);
+	return true;
+}
+#endif
+
+// Push GUI/command-line settings into the core
+void SimInstance::ApplySettings() {
+	top->emu__DOT__pause = pause_cpu;
+	top->emu__DOT__self_test = self_test;
+	top->emu__DOT__dip_language = dip_language;
+	top->emu__DOT__dip_coinage = dip_coinage;
+	top->emu__DOT__mouse_speed = mouse_speed;
+	top->emu__DOT__joystick_sensitivity = joystick_sensitivity;
+	top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__debug_cpu = debug_cpu & debug_enable;
+	top->emu__DOT__missile__DOT__debug_data = debug_data & debug_enable;
+}
+
+// Fast start: write the ROM download into the core's ROM arrays, decoding dn_addr
+// as missile.v does, and latch rom_downloaded so reset is released straight away
+void SimInstance::BackdoorRoms() {
+	long count = bus.Backdoor(0, [this](long address, unsigned char data) {
+		int a = address & 0xFFFF;
+		switch ((a >> 12) & 3) {
+		case 0: top->emu__DOT__missile__DOT__pgrom0__DOT__mem[a & 0xFFF] = data; break;
+		case 1: top->emu__DOT__missile__DOT__pgrom1__DOT__mem[a & 0xFFF] = data; break;
+		case 2: top->emu__DOT__missile__DOT__pgrom2__DOT__mem[a & 0xFFF] = data; break;
+		}
+		if ((a >> 12) == 3) { top->emu__DOT__missile__DOT__L6__DOT__mem[a & 0x1F] = data; }
+	});
+	if (count > 0) { top->emu__DOT__rom_downloaded = 1; }
+	console.AddLog("Backdoor loaded %ld ROM bytes", count);
+}
+
+// Sets up a benchmark scenario, limits given on the command line take precedence
+bool SimInstance::ApplyScenario() {
+	long frames;
+	if (scenario == "boot") { frames = 120; }	// ROM download through the ioctl bus, then the start of attract mode
+	else if (scenario == "attract") { frames = 600; rom_backdoor = true; }
+	else if (scenario == "gameplay") { frames = 1800; rom_backdoor = true; scenario_inputs = true; }
+	else if (scenario == "selftest") { frames = 600; rom_backdoor = true; self_test = 1; }
+	else { return false; }
+	if (headless_frames == 0 && headless_cycles == 0) { headless_frames = frames; }
+	return true;
+}
+
+// Gameplay script: coin up and start, then sweep the crosshair round in a square
+// while firing from each base in turn so missile trails keep the DRAM busy
+void SimInstance::ScriptInputs(int frame) {
+	const int directions[4] = { input_right, input_up, input_left, input_down };
+	const signed char axis_x[4] = { 63, 0, -63, 0 };
+	const signed char axis_y[4] = { 0, 63, 0, -63 };
+	int inputs = 0;
+	signed char joy_x = 0;
+	signed char joy_y = 0;
+	if (frame >= 100 && frame < 105) { inputs |= 1 << input_coin; }
+	if (frame >= 160 && frame < 165) { inputs |= 1 << input_startp1; }
+	if (frame >= 240) {
+		int direction = (frame / 30) % 4;
+		inputs |= 1 << directions[direction];
+		joy_x = axis_x[direction];
+		joy_y = axis_y[direction];
+		if (frame % 6 < 2) { inputs |= 1 << (input_fire1 + (frame / 6) % 3); }
+	}
+	top->inputs = inputs;
+	top->joystick_analog = ((unsigned char)-joy_y) << 8 | (unsigned char)joy_x;
+}
+
+// Peak resident set size of this process in KB
+long peakMemoryKB() {
+#ifdef WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+	return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void printUsage(const char* name) {
+	printf("Usage: %s [options] [+verilator+...]\n", name);
+	printf("  --headless      Run without a window until a limit is reached or the sim stops\n");
+	printf("  --threads N     Check the model was verilated with N threads (this build: %d)\n", model_threads);
+#ifdef SIM_HEADLESS
+	printf("  --jobs FILE     Run every job in FILE headless, in parallel, and report them as JSON. A job is a\n");
+	printf("                  line \"name options...\" taking the options below, $OUT in them is the job's folder.\n");
+	printf("                  Options given here as well apply to every job, before its own\n");
+	printf("  --parallel N    Jobs run at once (default: one per core), each model uses --threads of its own\n");
+	printf("  --jobs-out DIR  Folder the jobs' folders and logs go in (default: %s)\n", jobs_output.c_str());
+#endif
+#ifdef SIM_PROFILE
+	printf("  --profile       Start with the stage profiler running\n");
+	printf("  --profile-csv FILE  Per frame stage times written on exit\n");
+#endif
+#if !defined(SIM_HEADLESS) && !defined(WIN32)
+	printf("  --no-audio      Don't play the audio output in the GUI\n");
+#endif
+	printf("  --help          Show this message\n");
+	printf("Run options, also taken by jobs:\n");
+	printf("  --frames N      Stop headless run after N video frames\n");
+	printf("  --cycles N      Stop headless run after N sim ticks (main_time)\n");
+	printf("  --mra FILE      MRA file used to stage ROMs (default: %s)\n", default_mra_file);
+	printf("  --roms DIR      Folder holding the ROM zips and folders (default: %s)\n", SimBus_DefaultRomPath);
+	printf("  --zip-index FILE  Cache the zip CRC indexes in FILE between runs\n");
+	printf("  --rom-backdoor  Load ROMs straight into the model instead of using the ioctl download\n");
+	printf("  --self-test     Start with the self test switch on\n");
+	printf("  --dip-language N  Language DIP switch: 0 English, 1 French, 2 German, 3 Spanish\n");
+	printf("  --dip-coinage N   Coinage DIP switch (0-3)\n");
+	printf("  --prof-threads FILE  Write the thread profile of a --prof-threads model to FILE\n");
+	printf("                  (window set with +verilator+prof+threads+start+N / +window+N)\n");
+	printf("  --load-state FILE  Start from a saved state (also used by the GUI buttons)\n");
+	printf("  --save-state FILE  Save state when a headless run reaches its limit\n");
+#ifdef SIM_SAVABLE
+	printf("  --rewind-mb N   Memory budget for GUI rewind snapshots (default %d, 0 = off)\n", default_rewind_budget_mb);
+#endif
+	printf("  --trace FILE    MAME trace to compare 6502 instructions with (default: %s)\n", default_trace_file);
+	printf("  --trace-compare Compare with the MAME trace as binary records, logging only mismatches\n");
+	printf("  --trace-hash    Report a CRC32 of the executed instructions and the ticks they ran on\n");
+	printf("  --capture-png DIR  Write every completed frame to DIR/frame_NNNNNN.png\n");
+	printf("  --capture-y4m FILE  Write every completed frame to a Y4M video stream (4:4:4 YUV, so colours are\n");
+	printf("                  rounded by the RGB conversion: use --capture-png for exact pixels)\n");
+	printf("  --capture-manifest FILE  Write the CRC32 of every completed frame to FILE\n");
+	printf("  --capture-golden FILE  Fail on the first frame whose CRC32 differs from this manifest, or if the run\n");
+	printf("                  ends before reaching every frame in it. Skipped, and reported, if FILE doesn't exist yet\n");
+	printf("  --audio-wav FILE  Write the audio output to FILE as 48kHz 16-bit mono\n");
+	printf("  --audio-golden FILE  Fail if the sample count or CRC32 of the WAV data differs from FILE (skipped if it doesn't exist)\n");
+	printf("  --bless         Write the --capture-golden and --audio-golden files from this run instead of checking them\n");
+	printf("  --break ADDR    Stop when the 6502 fetches an opcode from ADDR (hex)\n");
+	printf("  --watch-read ADDR  Stop on a read of ADDR, ADDR-END or a region (RAM, POKEY, IN0-2, ROM)\n");
+	printf("  --watch-write ADDR  Stop on a write of ADDR, ADDR-END or a region (RAM, POKEY, OUT, COLRAM, WDOG, INTACK)\n");
+	printf("                  Points take =VV to only stop on that data byte and :N to only stop on hit N\n");
+	printf("  --cpu-profile FILE  Profile the 6502 code, the hottest addresses and routines are written to FILE on exit\n");
+	printf("  --symbols FILE  Name addresses in the 6502 profile from FILE (ADDR NAME or NAME = ADDR lines, hex)\n");
+	printf("  --record-inputs FILE  Write the core's inputs to an input movie as they change\n");
+	printf("  --replay-inputs FILE  Drive the core's inputs from an input movie (headless)\n");
+	printf("  --log FILE      Write the console lines to FILE as text (time severity source: text)\n");
+	printf("  --log-binary FILE  Write the console lines to FILE as binary records (read with logdump)\n");
+	printf("  --scenario NAME Run a benchmark scenario headless: boot, attract, gameplay or selftest\n");
+	printf("  --json          Report the headless run as one line of JSON\n");
+}
+
+// Reads the option at args[i] and its value, leaving i on the last word used.
+// 1 if it is an option of the instance, 0 if it isn't one, 2 if it is but is wrong.
+int SimInstance::ParseOption(const std::vector<std::string>& args, size_t& i) {
+	const std::string& arg = args[i];
+	bool hasValue = i + 1 < args.size();
+	if (arg == "--frames" && hasValue) { headless_frames = atol(args[++i].c_str()); }
+	else if (arg == "--cycles" && hasValue) { headless_cycles = strtoull(args[++i].c_str(), NULL, 10); }
+	else if (arg == "--mra" && hasValue) { mra_file = args[++i]; }
+	else if (arg == "--roms" && hasValue) { bus.romPath = args[++i]; if (!bus.romPath.empty() && bus.romPath.back() != '/' && bus.romPath.back() != '\\') { bus.romPath += "/"; } }
+	else if (arg == "--zip-index" && hasValue) { bus.zipIndexFile = args[++i]; }
+	else if (arg == "--rom-backdoor") { rom_backdoor = true; }
+	else if (arg == "--self-test") { self_test = 1; }
+	else if (arg == "--dip-language" && hasValue) { dip_language = atoi(args[++i].c_str()) & 3; }
+	else if (arg == "--dip-coinage" && hasValue) { dip_coinage = atoi(args[++i].c_str()) & 3; }
+	else if (arg == "--prof-threads" && hasValue) { prof_threads_file = args[++i]; }
+	else if (arg == "--load-state" && hasValue) { load_state_file = args[++i]; state_file = load_state_file; }
+	else if (arg == "--save-state" && hasValue) { save_state_file = args[++i]; }
+#ifdef SIM_SAVABLE
+	else if (arg == "--rewind-mb" && hasValue) { rewind_budget_mb = atoi(args[++i].c_str()); }
+#endif
+	else if (arg == "--trace" && hasValue) { trace_file = args[++i]; }
+	else if (arg == "--trace-compare") { trace_compare = true; }
+	else if (arg == "--trace-hash") { trace_hash = true; }
+	else if (arg == "--capture-png" && hasValue) { capture.pngFolder = args[++i]; }
+	else if (arg == "--capture-y4m" && hasValue) { capture.y4mFile = args[++i]; }
+	else if (arg == "--capture-manifest" && hasValue) { capture.manifestFile = args[++i]; }
+	else if (arg == "--capture-golden" && hasValue) { capture.goldenFile = args[++i]; }
+	else if (arg == "--audio-wav" && hasValue) { audio.wavFile = args[++i]; }
+	else if (arg == "--audio-golden" && hasValue) { audio_golden = args[++i]; }
+	else if (arg == "--bless") { bless = true; }
+	else if (arg == "--scenario" && hasValue) { scenario = args[++i]; }
+	else if (arg == "--json") { json_report = true; }
+	else if (arg == "--log" && hasValue) { log_sink.file = args[++i]; log_sink.binary = false; }
+	else if (arg == "--log-binary" && hasValue) { log_sink.file = args[++i]; log_sink.binary = true; }
+	else if ((arg == "--break" || arg == "--watch-read" || arg == "--watch-write") && hasValue) {
+		int kind = arg == "--break" ? break_pc : arg == "--watch-read" ? break_read : break_write;
+		if (!breaks.Add(kind, args[++i])) {
+			fprintf(out, "Not a breakpoint: %s %s\n", arg.c_str(), args[i].c_str());
+			return 2;
+		}
+	}
+	else if (arg == "--cpu-profile" && hasValue) { cpu_profile_file = args[++i]; cpu_profile.enabled = true; }
+	else if (arg == "--symbols" && hasValue) { symbol_file = args[++i]; }
+	else if (arg == "--record-inputs" && hasValue) { record_inputs_file = args[++i]; }
+	else if (arg == "--replay-inputs" && hasValue) { replay_inputs_file = args[++i]; }
+	else { return 0; }
+	return 1;
+}
+
+// Checks the options once they have all been read, -1 to carry on, otherwise the exit code
+int SimInstance::CheckOptions() {
+#ifndef SIM_SAVABLE
+	if (!load_state_file.empty() || !save_state_file.empty()) {
+		fprintf(out, "Save states need a model verilated with --savable\n");
+		return 2;
+	}
+#endif
+	if (!scenario.empty() && !ApplyScenario()) {
+		fprintf(out, "Unknown scenario: %s\n", scenario.c_str());
+		return 2;
+	}
+	if (!audio_golden.empty() && audio.wavFile.empty()) {
+		fprintf(out, "--audio-golden needs --audio-wav, the checksum is taken over the WAV data\n");
+		return 2;
+	}
+	// Blessing writes the manifest the frames would have been checked against
+	if (bless && !capture.goldenFile.empty()) {
+		capture.manifestFile = capture.goldenFile;
+		capture.goldenFile.clear();
+	}
+	// A golden that hasn't been blessed yet is skipped, and reported as skipped, rather than failing the run
+	if (!bless && !capture.goldenFile.empty() && !std::filesystem::exists(capture.goldenFile)) {
+		Summary("GOLDEN: " + capture.goldenFile + " not found, frames not checked");
+		capture.goldenFile.clear();
+		golden_skipped = true;
+	}
+	if (!bless && !audio_golden.empty() && !std::filesystem::exists(audio_golden)) {
+		Summary("GOLDEN: " + audio_golden + " not found, audio not checked");
+		audio_golden.clear();
+		golden_skipped = true;
+	}
+	return -1;
+}
+
+// Creates the model in a context of its own, so instances can run side by side, and starts
+// everything the options asked for. -1 to carry on, otherwise the exit code.
+int SimInstance::Start() {
+	// Console lines are stamped with the sim time, and written to the log file as well when there is one
+	console.SetTime(&main_time);
+	if (!log_sink.file.empty()) {
+		if (!log_sink.Start()) { return 2; }
+		console.SetSink(&log_sink);
+	}
+
+	// Map MAME debug log, lines are only read as the comparison reaches them
+	if (!trace_mame.Open(trace_file) && trace_compare) {
+		fprintf(out, "Cannot open MAME trace: %s\n", trace_file.c_str());
+		return 2;
+	}
+
+	if (!symbol_file.empty() && !cpu_profile.LoadSymbols(symbol_file)) { return 2; }
 
 	// Create core and initialise
-	top = new Vemu();
-	Verilated::commandArgs(argc, argv);
-	// Attach debug console to the verilated code
-	Verilated::setDebug(console);
+	context.reset(new VerilatedContext());
+	context->commandArgs(command_argc, command_argv);
+	if (!prof_threads_file.empty()) {
+		context->profThreadsFilename(prof_threads_file);
+	}
+	top = new Vemu(context.get());
 	// Reset sim
-	resetSim();
+	Reset();
+
+	// Hand completed frames to the capture worker
+	if (capture.Enabled()) {
+		if (!capture.Start(video.output_width, video.output_height)) { return 2; }
+		video.frame_done = [this](int frame, const uint32_t* pixels) { capture.Capture(frame, pixels); };
+	}
+	if (!audio.wavFile.empty() && !audio.Start()) { return 2; }
+
+	// Input movies, a replay is applied in the headless loop so it is only available there
+	if (!replay_inputs_file.empty() && !movie.Load(replay_inputs_file)) { return 2; }
+	if (!record_inputs_file.empty() && !movie.Record(record_inputs_file)) { return 2; }
 
 	// Attach bus
 	bus.ioctl_addr = &top->ioctl_addr;
@@ -514,6 +999,449 @@ int main(int argc, char** argv, char** env) {
 	bus.ioctl_dout = &top->ioctl_dout;
 	bus.ioctl_din = &top->ioctl_din;
 
+	// Stage roms for this core
+	// A core without its ROMs would still run, and pass or bless a blank screen
+	if (!bus.LoadMRA(mra_file)) { return 2; }
+	if (rom_backdoor) { BackdoorRoms(); }
+	return -1;
+}
+
+// Report lines after a run go to out, and are kept for the --jobs report
+void SimInstance::Summary(const std::string& line) {
+	fprintf(out, "%s\n", line.c_str());
+	summary.push_back(line);
+}
+
+// Waits for queued frames to be written and reports the capture, false if a frame differed from the golden
+// manifest or some of its frames were never reached
+bool SimInstance::FinishCapture() {
+	if (!capture.Enabled()) { return true; }
+	capture.Stop();
+	std::string line = fmt::format("CAPTURE: frames={} compared={}", capture.framesCaptured, capture.framesCompared);
+	if (capture.writeErrors > 0) { line += fmt::format(" write_errors={}", capture.writeErrors); }
+	bool match = true;
+	if (capture.firstMismatch >= 0) {
+		line += fmt::format(" first mismatch at frame {} (golden {:08x}, got {:08x})", capture.firstMismatch, capture.mismatchGolden, capture.mismatchHash);
+		match = false;
+	}
+	else if (capture.goldenMissing > 0) {
+		line += fmt::format(" {} golden frames not reached, from frame {}", capture.goldenMissing, capture.firstMissing);
+		match = false;
+	}
+	Summary(line);
+	return match;
+}
+
+// Writes out the rest of the log file and reports lines lost to a full queue
+void SimInstance::FinishLog() {
+	if (log_sink.file.empty()) { return; }
+	console.SetSink(NULL);
+	log_sink.Stop();
+	std::string line = fmt::format("LOG: lines={} dropped={}", log_sink.written, log_sink.dropped.load());
+	if (log_sink.writeErrors > 0) { line += fmt::format(" write_errors={}", log_sink.writeErrors); }
+	Summary(line);
+}
+
+// Closes the audio device, completes the WAV file and reports the checksum of the audio written,
+// false if it differs from the --audio-golden checksum (which --bless writes instead)
+bool SimInstance::FinishAudio() {
+#if !defined(SIM_HEADLESS) && !defined(WIN32)
+	audio.CloseDevice();
+#endif
+	audio.Stop();
+	if (audio.wavFile.empty()) { return true; }
+	std::string checksum = fmt::format("samples={} crc32={:08x}", audio.samplesWritten, audio.checksum);
+	std::string line = "AUDIO: " + checksum;
+	if (audio.writeErrors > 0) { line += fmt::format(" write_errors={}", audio.writeErrors); }
+	bool match = true;
+	if (!audio_golden.empty()) {
+		FILE* golden = fopen(audio_golden.c_str(), bless ? "w" : "r");
+		long samples = 0;
+		unsigned int crc = 0;
+		if (!golden) {
+			line += " cannot " + std::string(bless ? "write " : "read ") + audio_golden;
+			match = false;
+		}
+		else if (bless) { fprintf(golden, "%s\n", checksum.c_str()); }
+		else if (fscanf(golden, "samples=%ld crc32=%x", &samples, &crc) != 2) {
+			line += " golden is not a checksum: " + audio_golden;
+			match = false;
+		}
+		else if (samples != audio.samplesWritten || crc != audio.checksum) {
+			line += fmt::format(" differs from golden (samples={} crc32={:08x})", samples, crc);
+			match = false;
+		}
+		if (golden) { fclose(golden); }
+	}
+	Summary(line);
+	return match;
+}
+
+// Writes the 6502 profile report
+void SimInstance::FinishCpuProfile() {
+	if (cpu_profile_file.empty()) { return; }
+	if (!cpu_profile.WriteReport(cpu_profile_file, 40)) { return; }
+	Summary(fmt::format("CPU: cycles={} ticks={} report={}", (unsigned long long)cpu_profile.cycles, (unsigned long long)cpu_profile.ticks, cpu_profile_file));
+}
+
+// Stops everything Start() began, false if the frames or audio differed from their golden
+bool SimInstance::Finish() {
+	bool frames = FinishCapture();
+	bool sound = FinishAudio();
+	movie.Stop();
+	FinishCpuProfile();
+	FinishLog();
+	return frames && sound;
+}
+
+// Run the simulation in a tight loop with no GUI work between batches.
+// Returns 0 when the frame/cycle limit is reached or the model runs $finish, 1 if the sim stopped
+// itself (log mismatch), 3 if a captured frame or the audio differed from its golden or the run
+// ended before the golden's last frame
+int SimInstance::RunHeadless() {
+	if (headless_frames == 0 && headless_cycles == 0) {
+		console.AddLog("Headless run has no --frames or --cycles limit, running until stopped");
+	}
+
+	top->inputs = 0;
+	top->joystick_analog = 0;
+	ApplySettings();
+
+	int result = 0;
+	vluint64_t start_time = main_time;
+	int start_frame = video.count_frame;
+	int input_frame = -1;
+	auto start = std::chrono::steady_clock::now();
+	while (true) {
+		if (scenario_inputs && video.count_frame != input_frame) {
+			input_frame = video.count_frame;
+			ScriptInputs(input_frame);
+		}
+		while (movie.Due(video.count_frame, main_time)) { movie.Apply(top->inputs, top->joystick_analog); }
+		movie.Changed(main_time, top->inputs, top->joystick_analog);
+		if (!Verilate()) { break; }
+		if (!run_enable) { result = 1; break; }
+		if (headless_frames > 0 && video.count_frame >= headless_frames) { break; }
+		if (headless_cycles > 0 && main_time >= headless_cycles) { break; }
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+#ifdef SIM_SAVABLE
+	if (result == 0 && !save_state_file.empty() && !SaveState(save_state_file)) { result = 2; }
+#endif
+
+	// main_time counts both edges of the system clock
+	vluint64_t ticks = main_time - start_time;
+	int frames = video.count_frame - start_frame;
+	json = fmt::format("{{\"scenario\": \"{}\", \"result\": {}, \"threads\": {}, \"edges\": {}, \"ticks\": {}, \"cycles\": {}, \"frames\": {}, "
+		"\"wall_s\": {:.6f}, \"cycles_per_s\": {:.0f}, \"frames_per_s\": {:.3f}, \"peak_rss_kb\": {}}}",
+		scenario, result, model_threads, model_edges, (unsigned long long)ticks, (unsigned long long)(ticks / 2), frames,
+		seconds, seconds > 0 ? (ticks / 2) / seconds : 0.0, seconds > 0 ? frames / seconds : 0.0, peakMemoryKB());
+	if (json_report) {
+		fprintf(out, "%s\n", json.c_str());
+	}
+	else {
+		fprintf(out, "%s: threads=%d edges=%d main_time=%llu frames=%d wall=%.3fs ticks/s=%.0f fps=%.2f\n", result ? "STOPPED" : "DONE",
+			model_threads, model_edges, (unsigned long long)main_time, video.count_frame, seconds,
+			seconds > 0 ? ticks / seconds : 0.0, seconds > 0 ? frames / seconds : 0.0);
+	}
+
+	if (!replay_inputs_file.empty()) {
+		Summary(fmt::format("INPUTS: events={} replayed={}{}", movie.Count(), movie.applied, movie.Replaying() ? " (movie not finished)" : ""));
+	}
+	if (trace_hash) {
+		Summary(fmt::format("TRACE: instructions={} crc32={:08x}", trace_hashed, trace_crc));
+	}
+	if (trace_compare) {
+		Summary(fmt::format("TRACE: compared={}{}", trace_length < 0 ? log_index : trace_length, trace_length < 0 ? "" : " (end of trace)"));
+	}
+	if (!Finish() && result == 0) { result = 3; }
+	return result;
+}
+
+#ifdef SIM_HEADLESS
+// Parallel runs
+// -------------
+struct SimJob {
+	std::string name;
+	std::string folder;				// $OUT, holds the job's log
+	std::vector<std::string> options;
+	int status = -1;				// Exit code of the run, -1 if it never ran
+	std::string report;				// The run's JSON report
+	std::vector<std::string> summary;
+	bool skipped = false;			// Some of its goldens weren't there to check against
+};
+
+// One job per line: "name options...", lines starting with # are skipped. Options are split on
+// spaces, double quotes keep a value with spaces in one piece, and $OUT is the job's folder.
+bool loadJobs(const std::string& file, std::vector<SimJob>& jobs) {
+	std::ifstream in(file);
+	if (!in) {
+		printf("Cannot read job file: %s\n", file.c_str());
+		return false;
+	}
+	std::string line;
+	int number = 0;
+	while (std::getline(in, line)) {
+		number++;
+		std::vector<std::string> words;
+		std::string word;
+		bool quoted = false;
+		bool started = false;
+		for (char c : line) {
+			if (c == '"') { quoted = !quoted; started = true; }
+			else if (!quoted && isspace((unsigned char)c)) {
+				if (started) { words.push_back(word); }
+				word.clear();
+				started = false;
+			}
+			else { word += c; started = true; }
+		}
+		if (started) { words.push_back(word); }
+		if (words.empty() || words[0][0] == '#') { continue; }
+		if (quoted) {
+			printf("Job file %s line %d has an unterminated quote\n", file.c_str(), number);
+			return false;
+		}
+		SimJob job;
+		job.name = words[0];
+		job.folder = jobs_output + "/" + job.name;
+		for (const SimJob& other : jobs) {
+			if (other.name == job.name) {
+				printf("Job file %s line %d repeats the job name %s\n", file.c_str(), number, job.name.c_str());
+				return false;
+			}
+		}
+		for (size_t i = 1; i < words.size(); i++) {
+			std::string option = words[i];
+			for (size_t at = option.find("$OUT"); at != std::string::npos; at = option.find("$OUT", at + job.folder.size())) {
+				option.replace(at, 4, job.folder);
+			}
+			job.options.push_back(option);
+		}
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+// Runs a job headless on the calling thread, in an instance of its own with its console lines and
+// reports going to the job's log
+void runJob(SimJob& job, const std::vector<std::string>& shared_options) {
+	std::error_code error;
+	std::filesystem::remove_all(job.folder, error);
+	std::filesystem::create_directories(job.folder, error);
+	FILE* log = fopen((job.folder + "/log").c_str(), "w");
+	if (!log) {
+		fprintf(stderr, "%s: cannot write %s/log\n", job.name.c_str(), job.folder.c_str());
+		job.status = 2;
+		return;
+	}
+	fprintf(stderr, "%s started\n", job.name.c_str());
+
+	std::unique_ptr<SimInstance> sim(new SimInstance());
+	sim->name = job.name;
+	sim->out = log;
+	sim->output.file = log;
+	sim->json_report = true;
+	DebugConsole::SetThreadOutput(&sim->output);
+
+	int status = -1;
+	// Options from the command line come first, so the job's own override them
+	const std::vector<std::string>* option_lists[2] = { &shared_options, &job.options };
+	for (const std::vector<std::string>* options : option_lists) {
+		for (size_t i = 0; status < 0 && i < options->size(); i++) {
+			int parsed = sim->ParseOption(*options, i);
+			if (parsed == 0) { fprintf(log, "Not a job option: %s\n", (*options)[i].c_str()); }
+			if (parsed != 1) { status = 2; }
+		}
+	}
+	if (status < 0) { status = sim->CheckOptions(); }
+	if (status < 0) { status = sim->Start(); }
+#ifdef SIM_SAVABLE
+	if (status < 0 && !sim->load_state_file.empty() && !sim->LoadState(sim->load_state_file)) { status = 2; }
+#endif
+	if (status < 0) { status = sim->RunHeadless(); }
+	job.status = status;
+	job.report = sim->json;
+	job.summary = sim->summary;
+	job.skipped = sim->golden_skipped;
+
+	// The model's final lines still go to the job's log
+	sim.reset();
+	DebugConsole::SetThreadOutput(NULL);
+	fclose(log);
+	fprintf(stderr, "%s finished (%d)\n", job.name.c_str(), job.status);
+}
+
+std::string jsonString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') { quoted += '\\'; }
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+// Runs the jobs on a pool of threads, each taking the next job as it finishes one, and prints
+// every job's exit code, JSON report and summary lines in job file order. Exits 1 if any failed,
+// jobs with goldens missing are counted as skipped but don't fail.
+int runJobs(const std::vector<std::string>& shared_options) {
+	std::vector<SimJob> jobs;
+	if (!loadJobs(jobs_file, jobs)) { return 2; }
+	int parallel = jobs_parallel > 0 ? jobs_parallel : (int)std::thread::hardware_concurrency();
+	if (parallel < 1) { parallel = 1; }
+	if (parallel > (int)jobs.size()) { parallel = (int)jobs.size(); }
+	fprintf(stderr, "%d jobs, %d at a time\n", (int)jobs.size(), parallel);
+
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+	for (int i = 0; i < parallel; i++) {
+		pool.emplace_back([&]() {
+			for (size_t index = next++; index < jobs.size(); index = next++) { runJob(jobs[index], shared_options); }
+		});
+	}
+	for (std::thread& worker : pool) { worker.join(); }
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	int skipped = 0;
+	printf("{\n  \"jobs_file\": %s, \"parallel\": %d, \"threads\": %d, \"wall_s\": %.3f,\n  \"jobs\": [", jsonString(jobs_file).c_str(), parallel, model_threads, seconds);
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const SimJob& job = jobs[i];
+		if (job.status != 0) { failed++; }
+		if (job.skipped) { skipped++; }
+		std::string summary;
+		for (const std::string& line : job.summary) { summary += (summary.empty() ? "" : ", ") + jsonString(line); }
+		printf("%s\n    { \"name\": %s, \"status\": %d, \"skipped\": %s, \"report\": %s, \"summary\": [%s] }", i > 0 ? "," : "", jsonString(job.name).c_str(), job.status,
+			job.skipped ? "true" : "false", job.report.empty() ? "null" : job.report.c_str(), summary.c_str());
+	}
+	printf("\n  ],\n  \"failed\": %d,\n  \"skipped\": %d\n}\n", failed, skipped);
+	fprintf(stderr, "%d of %d jobs failed, %d had goldens missing (make regress-bless)\n", failed, (int)jobs.size(), skipped);
+	return failed > 0 ? 1 : 0;
+}
+#endif
+
+#ifndef SIM_HEADLESS
+#if !defined(WIN32)
+bool audio_live = true;		// Play the audio output through SDL in the GUI
+#endif
+
+// Simulation thread for the GUI, runs batches until the GUI exits
+void runSimulation(SimInstance& sim) {
+	while (!sim_quit) {
+		// Let a waiting GUI frame in before starting the next batch
+		while (gui_waiting) { std::this_thread::yield(); }
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(sim_mutex);
+			idle = !sim.run_enable && !sim.single_step && !sim.multi_step;
+			if (sim.run_enable) {
+				for (int step = 0; step < batchSize; step++) { sim.Verilate(); if (!sim.run_enable) { break; } }
+			}
+			else {
+				if (sim.single_step) { sim.Verilate(); sim.single_step = 0; }
+				if (sim.multi_step) {
+					for (int step = 0; step < multi_step_amount; step++) {
+						sim.Verilate(); if (!sim.multi_step) { break; }
+					}
+					sim.multi_step = 0;
+				}
+			}
+		}
+		if (idle) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+	}
+}
+#endif
+
+// Returns -1 to continue, otherwise the process exit code. Options for the instance are also
+// collected in instance_args, so --jobs can apply them to every job.
+int parseArgs(SimInstance& sim, std::vector<std::string>& instance_args, int argc, char** argv) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	for (size_t i = 0; i < args.size(); i++) {
+		const std::string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--headless") { headless = 1; }
+		else if (arg == "--threads" && hasValue) { requested_threads = atoi(args[++i].c_str()); }
+#ifdef SIM_HEADLESS
+		else if (arg == "--jobs" && hasValue) { jobs_file = args[++i]; }
+		else if (arg == "--parallel" && hasValue) { jobs_parallel = atoi(args[++i].c_str()); }
+		else if (arg == "--jobs-out" && hasValue) { jobs_output = args[++i]; }
+#endif
+#if !defined(SIM_HEADLESS) && !defined(WIN32)
+		else if (arg == "--no-audio") { audio_live = false; }
+#endif
+#ifdef SIM_PROFILE
+		else if (arg == "--profile") { profile.enabled = true; }
+		else if (arg == "--profile-csv" && hasValue) { profile_csv = args[++i]; }
+#endif
+		else if (arg == "--help" || arg == "-h") { printUsage(argv[0]); return 0; }
+		else if (arg[0] == '+') { continue; } // Verilator runtime arguments
+		else {
+			size_t first = i;
+			int parsed = sim.ParseOption(args, i);
+			if (parsed == 2) { return 2; }
+			if (parsed == 0) {
+				printf("Unknown or incomplete option: %s\n", arg.c_str());
+				printUsage(argv[0]);
+				return 2;
+			}
+			instance_args.insert(instance_args.end(), args.begin() + first, args.begin() + i + 1);
+		}
+	}
+#if defined(SIM_HEADLESS) && defined(SIM_PROFILE)
+	// The stage profiler is one set of totals for the process, every job would add to it at once
+	if (!jobs_file.empty() && (profile.enabled || !profile_csv.empty())) {
+		printf("--profile and --profile-csv can't be used with --jobs\n");
+		return 2;
+	}
+#endif
+	int checked = sim.CheckOptions();
+	if (checked >= 0) { return checked; }
+	if (!sim.scenario.empty()) { headless = 1; }
+	return -1;
+}
+
+int main(int argc, char** argv, char** env) {
+
+	command_argc = argc;
+	command_argv = argv;
+	SimInstance sim;
+	std::vector<std::string> instance_args;
+	int argResult = parseArgs(sim, instance_args, argc, argv);
+	if (argResult >= 0) { return argResult; }
+
+	if (requested_threads > 0 && requested_threads != model_threads) {
+		printf("Model was verilated with %d thread(s), %d requested: rebuild with make THREADS=%d\n", model_threads, requested_threads, requested_threads);
+		return 2;
+	}
+
+	// Attach debug console to the verilated code, a job's model logs to that job's output.
+	// The runtime keeps a copy, so its lines are tagged as the RTL's by the copy passed in.
+	DebugConsole rtl_console(log_rtl);
+	Verilated::setDebug(rtl_console);
+
+#ifdef SIM_HEADLESS
+	if (!jobs_file.empty()) { return runJobs(instance_args); }
+#endif
+
+	// Input movies, a replay is applied in the headless loop so it is only available there
+	if (!sim.replay_inputs_file.empty() && !headless) {
+		printf("Input movies can only be replayed with --headless\n");
+		return 2;
+	}
+
+	int started = sim.Start();
+	if (started >= 0) { return started; }
+
+	if (headless) {
+#ifdef SIM_SAVABLE
+		if (!sim.load_state_file.empty() && !sim.LoadState(sim.load_state_file)) { return 2; }
+#endif
+		return sim.RunHeadless();
+	}
+
+#ifndef SIM_HEADLESS
 	// Set up input module
 	input.Initialise();
 #ifdef WIN32
@@ -531,21 +1459,38 @@ int main(int argc, char** argv, char** env) {
 #endif
 
 	// Setup video output
-	if (video.Initialise(windowTitle) == 1) { return 1; }
+	if (sim.video.Initialise(windowTitle) == 1) { return 1; }
 
-	// Stage roms for this core
-	bus.LoadMRA("../releases/Missile Command (rev 1).mra");
+#ifndef WIN32
+	// Play audio live, the output is decimated whenever a device is open or a WAV is written
+	if (audio_live && sim.audio.OpenDevice() && !sim.audio.enabled) { sim.audio.Start(); }
+#endif
+
+#ifdef SIM_SAVABLE
+	// Rewind is only offered in the GUI
+	sim.rewind_ring.budget = (size_t)sim.rewind_budget_mb * 1024 * 1024;
+	if (!sim.load_state_file.empty()) { sim.LoadState(sim.load_state_file); }
+#endif
 	//bus.LoadMRA("../releases/Missile Command (rev 2).mra");
 	//bus.LoadMRA("../releases/Missile Command (rev 3).mra");
 	//bus.QueueDownload("roms/240/035820-02.h1", 0, 0);
 	//bus.QueueDownload("roms/240/035821-02.jk1", 0, 0);
 	//bus.QueueDownload("roms/240/035822-03e.kl1", 0, 0);
-	////bus.QueueDownload("roms/240/missile2/035822-02.kl1", 0);
+	////bus.QueueDownload("roms/240/missile2/035822-02.kl1", 0, 0);
 	//bus.QueueDownload("roms/240/035823-02.ln1", 0, 0);
 	//bus.QueueDownload("roms/240/035824-02.np1", 0, 0);
 	//bus.QueueDownload("roms/240/035825-02.r1", 0, 0);
 	//bus.QueueDownload("roms/240/035826-01.l6", 0, 0);
 
+#ifdef SIM_PROFILE
+	if (!profile_csv.empty() && !profile.StartCsv(profile_csv)) {
+		printf("Cannot write profile CSV: %s\n", profile_csv.c_str());
+		return 2;
+	}
+#endif
+
+	std::thread simThread(runSimulation, std::ref(sim));
+
 #ifdef WIN32
 	MSG msg;
 	ZeroMemory(&msg, sizeof(msg));
@@ -569,107 +1514,113 @@ int main(int argc, char** argv, char** env) {
 				done = true;
 		}
 #endif
-		video.StartFrame();
+		sim.video.StartFrame();
 
 		input.Read();
 
+		// Wait for the current simulation batch to finish
+		gui_waiting = true;
+		std::unique_lock<std::mutex> lock(sim_mutex);
+		gui_waiting = false;
+
+		// Timed from here so the wait for the batch isn't counted as GUI time
+		SIM_PROFILE_SCOPE(profile, profile_gui);
+
 		// Draw GUI
 		// --------
 		ImGui::NewFrame();
 
-		console.Draw("Debug Log", &showDebugWindow);
+		sim.console.Draw("Debug Log", &showDebugWindow);
+#ifdef SIM_PROFILE
+		if (showProfileWindow) { profile.Draw("Profiler", &showProfileWindow); }
+#endif
+		if (showBreakWindow) { sim.breaks.Draw("Breakpoints", &showBreakWindow); }
+		if (showCpuProfileWindow) { sim.cpu_profile.Draw("6502 Profile", &showCpuProfileWindow); }
 		ImGui::Begin(debugWindowTitle);
 
-		if (ImGui::Button("RESET")) { resetSim(); } ImGui::SameLine();
-		if (ImGui::Button("START")) { run_enable = 1; } ImGui::SameLine();
-		if (ImGui::Button("STOP")) { run_enable = 0; } ImGui::SameLine();
-		ImGui::Checkbox("RUN", &run_enable);
-		ImGui::Checkbox("STOP @ LOG MISMATCH", &stop_on_log_mismatch);
-		ImGui::Checkbox("Debug 6502", &debug_6502);
-		ImGui::Checkbox("Debug CPU", &debug_cpu);
-		ImGui::Checkbox("Debug DATA", &debug_data);
-		ImGui::Checkbox("Self Test", &self_test);
-		ImGui::Checkbox("FLIP MODE", &flip);
-
-		ImGui::Checkbox("Pause CPU", &pause);
-		top->emu__DOT__pause = pause;
-
-		if (self_test) {
-			top->emu__DOT__self_test = 1;
-		}
-		else {
-			top->emu__DOT__self_test = 0;
-		}
+		if (ImGui::Button("RESET")) { sim.Reset(); } ImGui::SameLine();
+		if (ImGui::Button("START")) { sim.run_enable = 1; } ImGui::SameLine();
+		if (ImGui::Button("STOP")) { sim.run_enable = 0; } ImGui::SameLine();
+		ImGui::Checkbox("RUN", &sim.run_enable);
+#ifdef SIM_SAVABLE
+		if (ImGui::Button("SAVE STATE")) { sim.SaveState(sim.state_file); } ImGui::SameLine();
+		if (ImGui::Button("LOAD STATE")) { sim.LoadState(sim.state_file); } ImGui::SameLine();
+		ImGui::Text("%s", sim.state_file.c_str());
+		if (ImGui::Button("REWIND")) { if (sim.RewindState(sim.rewind_frames)) { sim.run_enable = 0; } } ImGui::SameLine();
+		ImGui::SliderInt("Rewind frames", &sim.rewind_frames, 0, 600);
+		ImGui::Text("Rewind: %d snapshots from frame %d, %.1f MB of %d MB", sim.rewind_ring.Count(), sim.rewind_ring.OldestFrame(),
+			sim.rewind_ring.MemoryUsed() / (1024.0 * 1024.0), sim.rewind_budget_mb);
+#endif
+		ImGui::Checkbox("STOP @ LOG MISMATCH", &sim.stop_on_log_mismatch);
+		ImGui::Checkbox("Debug 6502", &sim.debug_6502);
+		ImGui::Checkbox("Debug CPU", &sim.debug_cpu);
+		ImGui::Checkbox("Debug DATA", &sim.debug_data);
+		ImGui::Checkbox("Self Test", &sim.self_test);
+		ImGui::Checkbox("FLIP MODE", &sim.flip);
+
+		ImGui::Checkbox("Pause CPU", &sim.pause_cpu);
 
 		ImGui::SliderInt("Batch size", &batchSize, 1, 100000);
 
-		if (single_step == 1) { single_step = 0; }
-		if (ImGui::Button("Single Step")) { run_enable = 0; single_step = 1; }
+		if (ImGui::Button("Single Step")) { sim.run_enable = 0; sim.single_step = 1; }
 		ImGui::SameLine();
-		if (multi_step == 1) { multi_step = 0; }
-		if (ImGui::Button("Multi Step")) { run_enable = 0; multi_step = 1; }
+		if (ImGui::Button("Multi Step")) { sim.run_enable = 0; sim.multi_step = 1; }
 		ImGui::SameLine();
 		ImGui::SliderInt("Step amount", &multi_step_amount, 8, 1024);
 
-		ImGui::SliderInt("Language", &dip_language, 0, 3);
-		top->emu__DOT__dip_language = dip_language;
-
-		ImGui::SliderInt("Coins per play", &dip_coinage, 0, 3);
-		top->emu__DOT__dip_coinage = dip_coinage;
-
-		ImGui::SliderInt("Mouse speed", &mouse_speed, 0, 3);
-		top->emu__DOT__mouse_speed = mouse_speed;
+		ImGui::SliderInt("Language", &sim.dip_language, 0, 3);
+		ImGui::SliderInt("Coins per play", &sim.dip_coinage, 0, 3);
+		ImGui::SliderInt("Mouse speed", &sim.mouse_speed, 0, 3);
+		ImGui::SliderInt("Joystick sensitivity", &sim.joystick_sensitivity, 0, 1);
 
-		ImGui::SliderInt("Joystick sensitivity", &joystick_sensitivity, 0, 1);
-		top->emu__DOT__joystick_sensitivity = joystick_sensitivity;
+		ImGui::SliderInt("Rotate", &sim.video.output_rotate, -1, 1); ImGui::SameLine();
+		ImGui::Checkbox("Flip V", &sim.video.output_vflip);
 
-		ImGui::SliderInt("Rotate", &video.output_rotate, -1, 1); ImGui::SameLine();
-		ImGui::Checkbox("Flip V", &video.output_vflip);
-
-		ImGui::Text("mouse_x: %d  mouse_y: %d", mouse_x, mouse_y);
-		/*ImGui::Text("mouse_mag_x: %d  mouse_mag_y: %d", top->emu__DOT__trackball__DOT__mouse_mag_x, top->emu__DOT__trackball__DOT__mouse_mag_y);*/
-		ImGui::Text("main_time: %d frame_count: %d sim FPS: %f", main_time, video.count_frame, video.stats_fps);
-		//ImGui::Text("hblank: %x vblank: %x hsync: %x vsync: %x", top->emu__DOT__missile__DOT__h_blank, top->emu__DOT__missile__DOT__v_blank, top->emu__DOT__missile__DOT__h_sync, top->emu__DOT__missile__DOT__v_sync);
-		ImGui::Text("hcnt: %d  vx: %d", top->emu__DOT__missile__DOT__sync_circuit__DOT__hcnt, video.count_pixel);
-		ImGui::Text("vcnt: %d  vy: %d", top->emu__DOT__missile__DOT__sync_circuit__DOT__vcnt, video.count_line);
+		ImGui::Text("mouse_x: %d  mouse_y: %d", sim.mouse_x, sim.mouse_y);
+		/*ImGui::Text("mouse_mag_x: %d  mouse_mag_y: %d", sim.top->emu__DOT__trackball__DOT__mouse_mag_x, sim.top->emu__DOT__trackball__DOT__mouse_mag_y);*/
+		ImGui::Text("main_time: %d frame_count: %d sim FPS: %f threads: %d", sim.main_time, sim.video.count_frame, sim.video.stats_fps, model_threads);
+#ifndef WIN32
+		ImGui::Text("audio underruns: %ld overruns: %ld playback rate: %.2f", sim.audio.underruns.load(), sim.audio.overruns.load(), sim.audio.playbackRate.load());
+#endif
+		//ImGui::Text("hblank: %x vblank: %x hsync: %x vsync: %x", sim.top->emu__DOT__missile__DOT__h_blank, sim.top->emu__DOT__missile__DOT__v_blank, sim.top->emu__DOT__missile__DOT__h_sync, sim.top->emu__DOT__missile__DOT__v_sync);
+		ImGui::Text("hcnt: %d  vx: %d", sim.top->emu__DOT__missile__DOT__sync_circuit__DOT__hcnt, sim.video.count_pixel);
+		ImGui::Text("vcnt: %d  vy: %d", sim.top->emu__DOT__missile__DOT__sync_circuit__DOT__vcnt, sim.video.count_line);
 
 		// Draw VGA output
 		float m = 2.0;
-		ImGui::Image(video.texture_id, ImVec2(video.output_width * m, video.output_height * m));
+		ImGui::Image(sim.video.texture_id, ImVec2(sim.video.output_width * m, sim.video.output_height * m));
 		ImGui::End();
 
 		//ImGui::Begin("PG-ROM0");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__pgrom0__DOT__mem, 4096, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__pgrom0__DOT__mem, 4096, 0);
 		//ImGui::End();
 		//ImGui::Begin("PG-ROM1");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__pgrom1__DOT__mem, 4096, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__pgrom1__DOT__mem, 4096, 0);
 		//ImGui::End();
 		//ImGui::Begin("PG-ROM2");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__pgrom2__DOT__mem, 4096, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__pgrom2__DOT__mem, 4096, 0);
 		//ImGui::End();
 		//ImGui::Begin("DRAM");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__ram__DOT__mem, 16384, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__ram__DOT__mem, 16384, 0);
 		//ImGui::End();
 		//ImGui::Begin("CRAM");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__L7__DOT__mem, 8, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__L7__DOT__mem, 8, 0);
 		//ImGui::End();
 		//ImGui::Begin("L6-ROM");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__missile__DOT__L6__DOT__mem, 32, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__missile__DOT__L6__DOT__mem, 32, 0);
 		//ImGui::End();
 		//ImGui::Begin("hiscore_data");
-		//memoryEditor_hs.DrawContents(&top->emu__DOT__hi__DOT__hiscore_data__DOT__ram, 48, 0);
+		//memoryEditor_hs.DrawContents(&sim.top->emu__DOT__hi__DOT__hiscore_data__DOT__ram, 48, 0);
 		//ImGui::End(); 
 
-		video.UpdateTexture();
-
 		// Pass inputs to sim
-		top->inputs = 0;
+		sim.top->inputs = 0;
 		for (int i = 0; i < input.inputCount; i++)
 		{
-			if (input.inputs[i]) { top->inputs |= (1 << i); }
+			if (input.inputs[i]) { sim.top->inputs |= (1 << i); }
 		}
 
-		mouse_buttons = 0 | (input.inputs[4]);
+		sim.mouse_buttons = 0 | (input.inputs[4]);
 
 		//if (input.keyState[DIK_LSHIFT]) {
 
@@ -678,58 +1629,59 @@ int main(int argc, char** argv, char** env) {
 		int dec = 1;
 		int fric = 2;
 
-		if (input.inputs[input_left]) { mouse_x -= acc; }
-		else if (mouse_x < 0) { mouse_x += (dec + (-mouse_x / fric)); }
+		if (input.inputs[input_left]) { sim.mouse_x -= acc; }
+		else if (sim.mouse_x < 0) { sim.mouse_x += (dec + (-sim.mouse_x / fric)); }
 
-		if (input.inputs[input_right]) { mouse_x += acc; }
-		else if (mouse_x > 0) { mouse_x -= (dec + (mouse_x / fric)); }
+		if (input.inputs[input_right]) { sim.mouse_x += acc; }
+		else if (sim.mouse_x > 0) { sim.mouse_x -= (dec + (sim.mouse_x / fric)); }
 
-		if (input.inputs[input_up]) { mouse_y += acc; }
-		else if (mouse_y > 0) { mouse_y -= (dec + (mouse_y / fric)); }
+		if (input.inputs[input_up]) { sim.mouse_y += acc; }
+		else if (sim.mouse_y > 0) { sim.mouse_y -= (dec + (sim.mouse_y / fric)); }
 
-		if (input.inputs[input_down]) { mouse_y -= acc; }
-		else if (mouse_y < 0) { mouse_y += (dec + (-mouse_y / fric)); }
+		if (input.inputs[input_down]) { sim.mouse_y -= acc; }
+		else if (sim.mouse_y < 0) { sim.mouse_y += (dec + (-sim.mouse_y / fric)); }
 
 		int lim = 127;
-		if (mouse_x > lim) { mouse_x = lim; }
-		if (mouse_x < -lim) { mouse_x = -lim; }
-		if (mouse_y > lim) { mouse_y = lim; }
-		if (mouse_y < -lim) { mouse_y = -lim; }
+		if (sim.mouse_x > lim) { sim.mouse_x = lim; }
+		if (sim.mouse_x < -lim) { sim.mouse_x = -lim; }
+		if (sim.mouse_y > lim) { sim.mouse_y = lim; }
+		if (sim.mouse_y < -lim) { sim.mouse_y = -lim; }
 
-		signed char joy_x = mouse_x / 2;
-		signed char joy_y = mouse_y / 2;
+		signed char joy_x = sim.mouse_x / 2;
+		signed char joy_y = sim.mouse_y / 2;
 
 		unsigned short joy = ((unsigned char)-joy_y) << 8;
 		joy |= (unsigned char)joy_x;
 
-		top->joystick_analog = joy;
+		sim.top->joystick_analog = joy;
+		sim.movie.Changed(sim.main_time, sim.top->inputs, sim.top->joystick_analog);
 
 		//}
 		//else {
 			//int mspeed = 64;
-			//mouse_x = 0;
-			//mouse_y = 0; 
-			//if (input.inputs[input_left]) { mouse_x = -mspeed; }
-			//if (input.inputs[input_right]) { mouse_x = +mspeed; }
-			//if (input.inputs[input_up]) { mouse_y = +mspeed; }
-			//if (input.inputs[input_down]) { mouse_y = -mspeed; }
+			//sim.mouse_x = 0;
+			//sim.mouse_y = 0; 
+			//if (input.inputs[input_left]) { sim.mouse_x = -mspeed; }
+			//if (input.inputs[input_right]) { sim.mouse_x = +mspeed; }
+			//if (input.inputs[input_up]) { sim.mouse_y = +mspeed; }
+			//if (input.inputs[input_down]) { sim.mouse_y = -mspeed; }
 		//}
 
 
 		//unsigned char ps2_mouse1;
 		//unsigned char ps2_mouse2;
-		//int x = mouse_x;
-		//mouse_buttons |= (x < 0) ? 0x10 : 0x00;
+		//int x = sim.mouse_x;
+		//sim.mouse_buttons |= (x < 0) ? 0x10 : 0x00;
 		//if (x < -255)
 		//{
 		//	// min possible value + overflow flag
-		//	mouse_buttons |= 0x40;
+		//	sim.mouse_buttons |= 0x40;
 		//	ps2_mouse1 = 1; // -255
 		//}
 		//else if (x > 255)
 		//{
 		//	// max possible value + overflow flag
-		//	mouse_buttons |= 0x40;
+		//	sim.mouse_buttons |= 0x40;
 		//	ps2_mouse1 = 255;
 		//}
 		//else
@@ -739,18 +1691,18 @@ int main(int argc, char** argv, char** env) {
 
 		//// ------ Y axis -----------
 		//// store sign bit in first byte
-		//int y = mouse_y;
-		//mouse_buttons |= (y < 0) ? 0x20 : 0x00;
+		//int y = sim.mouse_y;
+		//sim.mouse_buttons |= (y < 0) ? 0x20 : 0x00;
 		//if (y < -255)
 		//{
 		//	// min possible value + overflow flag
-		//	mouse_buttons |= 0x80;
+		//	sim.mouse_buttons |= 0x80;
 		//	ps2_mouse2 = 1; // -255;
 		//}
 		//else if (y > 255)
 		//{
 		//	// max possible value + overflow flag
-		//	mouse_buttons |= 0x80;
+		//	sim.mouse_buttons |= 0x80;
 		//	ps2_mouse2 = 255;
 		//}
 		//else
@@ -758,37 +1710,37 @@ int main(int argc, char** argv, char** env) {
 		//	ps2_mouse2 = (char)y;
 		//}
 
-		//unsigned long mouse_temp = mouse_buttons;
+		//unsigned long mouse_temp = sim.mouse_buttons;
 		//mouse_temp += (((unsigned char)ps2_mouse1) << 8);
 		//mouse_temp += (((unsigned char)ps2_mouse2) << 16);
 		//if (mouse_clock) { mouse_temp |= (1UL << 24); }
 
 		//mouse_clock = !mouse_clock;
 
-		//top->ps2_mouse = mouse_temp;
-		//top->ps2_mouse_ext = mouse_x + (mouse_buttons << 8);
+		//sim.top->ps2_mouse = mouse_temp;
+		//sim.top->ps2_mouse_ext = sim.mouse_x + (sim.mouse_buttons << 8);
 
-		// Run simulation
-		top->emu__DOT__missile__DOT__mp__DOT__bc6502__DOT__debug_cpu = debug_cpu & debug_enable;
-		top->emu__DOT__missile__DOT__debug_data = debug_data & debug_enable;
-		if (run_enable) {
-			for (int step = 0; step < batchSize; step++) { verilate(); if (!run_enable) { break; } }
-		}
-		else {
-			if (single_step) { verilate(); }
-			if (multi_step) {
-				for (int step = 0; step < multi_step_amount; step++) {
-					verilate(); if (!multi_step) { break; }
-				}
-			}
-		}
+		sim.ApplySettings();
+		lock.unlock();
+
+		// Upload the last completed frame and present while the simulation carries on
+		sim.video.UpdateTexture();
 	}
 
+	sim_quit = true;
+	simThread.join();
+	sim.Finish();
+#ifdef SIM_PROFILE
+	profile.StopCsv();
+	if (profile.csvRows > 0) { printf("Profile of %ld frames written to %s\n", profile.csvRows, profile_csv.c_str()); }
+#endif
+
 	// Clean up before exit
 	// --------------------
 
-	video.CleanUp();
+	sim.video.CleanUp();
 	input.CleanUp();
+#endif
 
 	return 0;
 }
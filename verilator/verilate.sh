@@ -1,7 +1,10 @@
 export OPTIMIZE="--x-assign fast --x-initial fast --noassert"
 export WARNINGS="-Wno-fatal"
+# COMPILER, SAVABLE and VERILATOR_EXTRA can be overridden by the caller (see Makefile)
+export COMPILER=${COMPILER:-msvc}
+export SAVABLE=${SAVABLE---savable}
 verilator \
--cc --compiler msvc +define+SIMULATION=1 $WARNINGS $OPTIMIZE \
+-cc --compiler $COMPILER +define+SIMULATION=1 $WARNINGS $OPTIMIZE $SAVABLE $VERILATOR_EXTRA \
 --top-module emu sim.v \
 -I../rtl \
 -I../rtl/pokey \